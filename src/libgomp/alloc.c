@@ -28,6 +28,7 @@
 
 #include "libgomp.h"
 #include <stdlib.h>
+#include <string.h>
 
 
 void *
@@ -56,3 +57,392 @@ gomp_realloc (void *old, size_t size)
     gomp_fatal ("Out of memory allocating %lu bytes", (unsigned long) size);
   return ret;
 }
+
+/* Allocate SIZE bytes aligned to AL, which must be a power of two.  The
+   pointer malloc returned is stashed right below the aligned block, so
+   memory obtained here must be released with gomp_aligned_free.  */
+
+void *
+gomp_aligned_alloc (size_t al, size_t size)
+{
+  void *ret, *p;
+
+  p = gomp_malloc (size + al + sizeof (void *));
+  ret = (void *) (((uintptr_t) p + sizeof (void *) + al - 1)
+		  & ~(uintptr_t) (al - 1));
+  ((void **) ret)[-1] = p;
+  return ret;
+}
+
+void
+gomp_aligned_free (void *ptr)
+{
+  if (ptr != NULL)
+    free (((void **) ptr)[-1]);
+}
+
+
+/* A per-thread slab allocator for task descriptors, taskgroups and
+   dependency bookkeeping, which are allocated and freed at a high rate.
+   Objects of up to GOMP_SLAB_MAX_SIZE bytes, header included, are carved
+   out of slabs owned by the allocating thread, one list of slabs with
+   free objects per power-of-two size class.  The owner returns objects
+   straight to their slab.  Other threads push them on the remote_free
+   list of the owner's depot, which the owner takes over as a whole the
+   next time it runs out of free objects of some size class.
+
+   The depot lives on the heap rather than in the owner's TLS, so that it
+   outlasts the owner: when a thread exits with objects of its slabs
+   still in use, the depot is marked orphaned, and the threads freeing
+   those objects later take them back themselves, under
+   gomp_slab_orphan_lock, releasing each slab once all its objects are
+   free.  A depot left without slabs is kept on a spare list for the next
+   thread, as some thread may still be looking at it.  */
+
+#define GOMP_SLAB_SIZE 16384
+#define GOMP_SLAB_MIN_SHIFT 7
+#define GOMP_SLAB_MAX_SIZE \
+  (1UL << (GOMP_SLAB_MIN_SHIFT + GOMP_SLAB_CLASSES - 1))
+
+struct gomp_slab_depot
+{
+  /* Objects freed by threads other than the owner.  */
+  struct gomp_slab_hdr *remote_free;
+  /* Number of slabs returning objects here.  Only changed by the owner,
+     or under gomp_slab_orphan_lock once it has exited.  */
+  unsigned long nslabs;
+  /* Set under gomp_slab_orphan_lock when the owner exits.  */
+  bool orphaned;
+  /* Link in gomp_slab_spare_depots.  */
+  struct gomp_slab_depot *next_spare;
+};
+
+static gomp_mutex_t gomp_slab_orphan_lock;
+static struct gomp_slab_depot *gomp_slab_spare_depots;
+
+#if !GOMP_MUTEX_INIT_0
+static void __attribute__((constructor))
+initialize_slab (void)
+{
+  gomp_mutex_init (&gomp_slab_orphan_lock);
+}
+#endif
+
+struct gomp_slab
+{
+  struct gomp_slab_depot *depot;
+  /* Links in the owner's list of slabs with free objects.  */
+  struct gomp_slab *next, *prev;
+  struct gomp_slab_hdr *free_list;
+  unsigned nfree, nobjs;
+  unsigned size_class;
+} __attribute__((aligned (16)));
+
+/* This precedes every object.  SLAB is NULL for objects too big for any
+   size class, which come from malloc and record their SIZE.  */
+
+struct gomp_slab_hdr
+{
+  struct gomp_slab *slab;
+  union
+  {
+    size_t size;
+    /* Link in a free list while the object is free.  */
+    struct gomp_slab_hdr *next;
+  };
+} __attribute__((aligned (16)));
+
+static inline unsigned
+gomp_slab_class (size_t total)
+{
+  if (total <= (1UL << GOMP_SLAB_MIN_SHIFT))
+    return 0;
+  return (sizeof (long) * __CHAR_BIT__ - __builtin_clzl (total - 1)
+	  - GOMP_SLAB_MIN_SHIFT);
+}
+
+static inline void
+gomp_slab_unlink (struct gomp_slab_cache *cache, struct gomp_slab *slab)
+{
+  if (slab->prev)
+    slab->prev->next = slab->next;
+  else
+    cache->partial[slab->size_class] = slab->next;
+  if (slab->next)
+    slab->next->prev = slab->prev;
+}
+
+static inline void
+gomp_slab_link (struct gomp_slab_cache *cache, struct gomp_slab *slab)
+{
+  slab->prev = NULL;
+  slab->next = cache->partial[slab->size_class];
+  if (slab->next)
+    slab->next->prev = slab;
+  cache->partial[slab->size_class] = slab;
+}
+
+/* Give CACHE a depot, a spare one if there is any.  Each depot is on a
+   cache line of its own, as other threads write it.  */
+
+static void
+gomp_slab_depot_new (struct gomp_slab_cache *cache)
+{
+  struct gomp_slab_depot *depot;
+
+  gomp_mutex_lock (&gomp_slab_orphan_lock);
+  depot = gomp_slab_spare_depots;
+  if (depot != NULL)
+    gomp_slab_spare_depots = depot->next_spare;
+  else
+    depot = gomp_aligned_alloc (64, sizeof (*depot));
+  depot->remote_free = NULL;
+  depot->nslabs = 0;
+  depot->orphaned = false;
+  gomp_mutex_unlock (&gomp_slab_orphan_lock);
+  cache->depot = depot;
+}
+
+static struct gomp_slab *
+gomp_slab_new (struct gomp_slab_cache *cache, unsigned size_class)
+{
+  size_t objsize = 1UL << (size_class + GOMP_SLAB_MIN_SHIFT);
+  struct gomp_slab *slab = gomp_malloc (GOMP_SLAB_SIZE);
+  char *p = (char *) (slab + 1);
+  unsigned i;
+
+  if (__builtin_expect (cache->depot == NULL, 0))
+    gomp_slab_depot_new (cache);
+  cache->depot->nslabs++;
+  slab->depot = cache->depot;
+  slab->size_class = size_class;
+  slab->nobjs = (GOMP_SLAB_SIZE - sizeof (*slab)) / objsize;
+  slab->nfree = slab->nobjs;
+  slab->free_list = (struct gomp_slab_hdr *) p;
+  for (i = 0; i < slab->nobjs; i++, p += objsize)
+    {
+      struct gomp_slab_hdr *obj = (struct gomp_slab_hdr *) p;
+      obj->slab = slab;
+      obj->next = i + 1 < slab->nobjs ? (struct gomp_slab_hdr *) (p + objsize)
+				      : NULL;
+    }
+  gomp_slab_link (cache, slab);
+  return slab;
+}
+
+/* Return OBJ to its slab, which belongs to CACHE.  A slab whose objects
+   are all free is released, unless it is the only one left of its size
+   class.  */
+
+static void
+gomp_slab_free_local (struct gomp_slab_cache *cache, struct gomp_slab_hdr *obj)
+{
+  struct gomp_slab *slab = obj->slab;
+
+  obj->next = slab->free_list;
+  slab->free_list = obj;
+  if (slab->nfree++ == 0)
+    gomp_slab_link (cache, slab);
+  else if (slab->nfree == slab->nobjs && (slab->prev || slab->next))
+    {
+      gomp_slab_unlink (cache, slab);
+      cache->depot->nslabs--;
+      free (slab);
+    }
+}
+
+/* Take back the objects other threads have freed to CACHE.  */
+
+static void
+gomp_slab_drain (struct gomp_slab_cache *cache)
+{
+  struct gomp_slab_hdr *obj, *next;
+
+  if (cache->depot == NULL
+      || __atomic_load_n (&cache->depot->remote_free,
+			  MEMMODEL_RELAXED) == NULL)
+    return;
+  obj = __atomic_exchange_n (&cache->depot->remote_free, NULL,
+			     MEMMODEL_ACQUIRE);
+  for (; obj; obj = next)
+    {
+      next = obj->next;
+      gomp_slab_free_local (cache, obj);
+    }
+}
+
+/* Take back the objects freed to DEPOT, whose owner has exited, and
+   release the slabs that are left without objects in use.  Nothing is
+   allocated from them any more, so the free lists don't matter.  Must
+   be called with gomp_slab_orphan_lock held.  */
+
+static void
+gomp_slab_drain_orphan (struct gomp_slab_depot *depot)
+{
+  struct gomp_slab_hdr *obj, *next;
+
+  /* The depot may have been handed to a new thread meanwhile.  */
+  if (!depot->orphaned)
+    return;
+  obj = __atomic_exchange_n (&depot->remote_free, NULL, MEMMODEL_ACQUIRE);
+  for (; obj; obj = next)
+    {
+      struct gomp_slab *slab = obj->slab;
+
+      next = obj->next;
+      if (++slab->nfree == slab->nobjs)
+	{
+	  free (slab);
+	  if (--depot->nslabs == 0)
+	    {
+	      depot->next_spare = gomp_slab_spare_depots;
+	      gomp_slab_spare_depots = depot;
+	    }
+	}
+    }
+}
+
+void *
+gomp_slab_alloc (size_t size)
+{
+  struct gomp_slab_cache *cache = &gomp_thread ()->slab_cache;
+  size_t total = size + sizeof (struct gomp_slab_hdr);
+  struct gomp_slab_hdr *obj;
+  struct gomp_slab *slab;
+  unsigned size_class;
+
+  if (__builtin_expect (total > GOMP_SLAB_MAX_SIZE, 0))
+    {
+      obj = gomp_malloc (total);
+      obj->slab = NULL;
+      obj->size = size;
+      return obj + 1;
+    }
+
+  size_class = gomp_slab_class (total);
+  slab = cache->partial[size_class];
+  if (__builtin_expect (slab == NULL, 0))
+    {
+      gomp_slab_drain (cache);
+      slab = cache->partial[size_class];
+      if (slab == NULL)
+	slab = gomp_slab_new (cache, size_class);
+    }
+  obj = slab->free_list;
+  slab->free_list = obj->next;
+  if (--slab->nfree == 0)
+    gomp_slab_unlink (cache, slab);
+  return obj + 1;
+}
+
+void
+gomp_slab_free (void *ptr)
+{
+  struct gomp_slab_hdr *obj = (struct gomp_slab_hdr *) ptr - 1;
+  struct gomp_slab_cache *cache;
+  struct gomp_slab_depot *depot;
+
+  if (ptr == NULL)
+    return;
+  if (obj->slab == NULL)
+    {
+      free (obj);
+      return;
+    }
+
+  cache = &gomp_thread ()->slab_cache;
+  depot = obj->slab->depot;
+  if (depot == cache->depot)
+    {
+      gomp_slab_free_local (cache, obj);
+      return;
+    }
+
+  /* The release pairs with the acquire in gomp_slab_drain.  Together
+     with the seq-cst load below, this also pairs with the setting of the
+     orphaned flag in gomp_slab_release: either the exiting owner takes
+     OBJ back, or we see the flag and do it ourselves.  */
+  obj->next = __atomic_load_n (&depot->remote_free, MEMMODEL_RELAXED);
+  while (!__atomic_compare_exchange_n (&depot->remote_free, &obj->next, obj,
+				       true, MEMMODEL_SEQ_CST,
+				       MEMMODEL_RELAXED))
+    ;
+  if (__builtin_expect (__atomic_load_n (&depot->orphaned,
+					 MEMMODEL_SEQ_CST), 0))
+    {
+      gomp_mutex_lock (&gomp_slab_orphan_lock);
+      gomp_slab_drain_orphan (depot);
+      gomp_mutex_unlock (&gomp_slab_orphan_lock);
+    }
+}
+
+void *
+gomp_slab_realloc (void *ptr, size_t size)
+{
+  struct gomp_slab_hdr *obj = (struct gomp_slab_hdr *) ptr - 1;
+  size_t old_size;
+  void *ret;
+
+  if (ptr == NULL)
+    return gomp_slab_alloc (size);
+  if (obj->slab == NULL)
+    {
+      if (size + sizeof (*obj) > GOMP_SLAB_MAX_SIZE)
+	{
+	  obj = gomp_realloc (obj, size + sizeof (*obj));
+	  obj->size = size;
+	  return obj + 1;
+	}
+      old_size = obj->size;
+    }
+  else
+    old_size = ((1UL << (obj->slab->size_class + GOMP_SLAB_MIN_SHIFT))
+		- sizeof (*obj));
+  if (size <= old_size)
+    return ptr;
+  ret = gomp_slab_alloc (size);
+  memcpy (ret, ptr, old_size);
+  gomp_slab_free (ptr);
+  return ret;
+}
+
+/* Called when THR exits, to release the slabs it owns.  Those with
+   objects still in use are left to the threads that free them.  */
+
+void
+gomp_slab_release (struct gomp_thread *thr)
+{
+  struct gomp_slab_cache *cache = &thr->slab_cache;
+  struct gomp_slab_depot *depot = cache->depot;
+  struct gomp_slab *slab, *next;
+  unsigned i;
+
+  if (depot == NULL)
+    return;
+  gomp_slab_drain (cache);
+  for (i = 0; i < GOMP_SLAB_CLASSES; i++)
+    {
+      for (slab = cache->partial[i]; slab; slab = next)
+	{
+	  next = slab->next;
+	  if (slab->nfree == slab->nobjs)
+	    {
+	      depot->nslabs--;
+	      free (slab);
+	    }
+	}
+      cache->partial[i] = NULL;
+    }
+
+  gomp_mutex_lock (&gomp_slab_orphan_lock);
+  __atomic_store_n (&depot->orphaned, true, MEMMODEL_SEQ_CST);
+  if (depot->nslabs == 0)
+    {
+      depot->next_spare = gomp_slab_spare_depots;
+      gomp_slab_spare_depots = depot;
+    }
+  else
+    gomp_slab_drain_orphan (depot);
+  gomp_mutex_unlock (&gomp_slab_orphan_lock);
+  cache->depot = NULL;
+}
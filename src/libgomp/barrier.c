@@ -51,3 +51,93 @@ GOMP_barrier_cancel (void)
      never have an orphaned cancellable barrier.  */
   return gomp_team_barrier_wait_cancel (&team->barrier);
 }
+
+
+/* Split-phase barrier.  omp_barrier_arrive counts the calling thread as
+   arrived at the team barrier, and omp_barrier_wait with the token it
+   returned waits for the rest of the team.  In between, the thread may do
+   work of its own, but must not encounter any other barrier or
+   worksharing construct, nor create tasks.  */
+
+omp_barrier_token_t
+omp_barrier_arrive (void)
+{
+  struct gomp_thread *thr = gomp_thread ();
+  struct gomp_team *team = thr->ts.team;
+
+  /* It is legal to have orphaned barriers.  */
+  if (team == NULL)
+    return 0;
+
+  return gomp_team_barrier_arrive (&team->barrier);
+}
+
+void
+omp_barrier_wait (omp_barrier_token_t token)
+{
+  struct gomp_thread *thr = gomp_thread ();
+  struct gomp_team *team = thr->ts.team;
+
+  if (team == NULL)
+    return;
+
+  gomp_team_barrier_wait_arrived (&team->barrier, token);
+}
+
+
+/* Fused barrier and reduction, see gomp_team_barrier_reduce.  This
+   defines omp_barrier_reduce_TYPE, with the functions combining values of
+   TYPE, which are stored in FIELD of gomp_barrier_value_t.  */
+
+#define GOMP_BARRIER_REDUCE(TYPE, FIELD)				\
+static void								\
+gomp_barrier_sum_##TYPE (gomp_barrier_value_t *a,			\
+			 const gomp_barrier_value_t *b)			\
+{									\
+  a->FIELD += b->FIELD;							\
+}									\
+									\
+static void								\
+gomp_barrier_min_##TYPE (gomp_barrier_value_t *a,			\
+			 const gomp_barrier_value_t *b)			\
+{									\
+  if (b->FIELD < a->FIELD)						\
+    a->FIELD = b->FIELD;						\
+}									\
+									\
+static void								\
+gomp_barrier_max_##TYPE (gomp_barrier_value_t *a,			\
+			 const gomp_barrier_value_t *b)			\
+{									\
+  if (b->FIELD > a->FIELD)						\
+    a->FIELD = b->FIELD;						\
+}									\
+									\
+TYPE									\
+omp_barrier_reduce_##TYPE (TYPE value, omp_reduction_op_t op)		\
+{									\
+  static const gomp_barrier_combine_fn combine[] =			\
+    {									\
+      [omp_reduction_sum] = gomp_barrier_sum_##TYPE,			\
+      [omp_reduction_min] = gomp_barrier_min_##TYPE,			\
+      [omp_reduction_max] = gomp_barrier_max_##TYPE			\
+    };									\
+  struct gomp_thread *thr = gomp_thread ();				\
+  struct gomp_team *team = thr->ts.team;				\
+  gomp_barrier_value_t v;						\
+									\
+  if ((unsigned) op > omp_reduction_max)				\
+    gomp_fatal ("Invalid reduction operation %d", (int) op);		\
+  /* It is legal to have orphaned barriers.  */				\
+  if (team == NULL)							\
+    return value;							\
+									\
+  v.FIELD = value;							\
+  gomp_team_barrier_reduce (&team->barrier, &v, combine[op]);		\
+  return v.FIELD;							\
+}
+
+GOMP_BARRIER_REDUCE (int, i)
+GOMP_BARRIER_REDUCE (long, l)
+GOMP_BARRIER_REDUCE (float, f)
+GOMP_BARRIER_REDUCE (double, d)
@@ -44,6 +44,98 @@
 #define CPU_CLR_S(idx, size, set) CPU_CLR(idx, set)
 #endif
 
+/* Socket (physical package) of each place in gomp_places_list, and the
+   number of distinct sockets the places span.  */
+unsigned short *gomp_places_socket;
+unsigned long gomp_num_sockets = 1;
+
+/* Last level cache and core of each place in gomp_places_list, numbered
+   like the sockets.  Places in different sockets never share a cache
+   number, nor places with different caches a core number.  */
+unsigned short *gomp_places_cache;
+unsigned short *gomp_places_core;
+
+/* Number the places in gomp_places_list by the contents of the sysfs FILE
+   of the first logical CPU of each place, within the groups of OUTER if
+   that is non-NULL, and store the numbers in GROUP.  Places are numbered
+   densely in the order they are first seen.  A place whose FILE can't be
+   read is put in the same group as all the others of its OUTER group that
+   couldn't be read.  Return the number of groups.  */
+
+static unsigned long
+gomp_affinity_group_places (const char *file, const unsigned short *outer,
+			    unsigned short *group)
+{
+  char name[sizeof ("/sys/devices/system/cpu/cpu/") + 3 * sizeof (unsigned long)
+	    + 32];
+  unsigned long i, j, ngroups = 0, max = 8 * gomp_cpuset_size;
+  char **keys = gomp_alloca (gomp_places_list_len * sizeof (char *));
+  unsigned short *outers
+    = gomp_alloca (gomp_places_list_len * sizeof (unsigned short));
+  char *line = NULL;
+  size_t linelen = 0;
+  FILE *f;
+
+  for (i = 0; i < gomp_places_list_len; i++)
+    {
+      cpu_set_t *cpusetp = (cpu_set_t *) gomp_places_list[i];
+      unsigned long cpu;
+      const char *key = "";
+
+      for (cpu = 0; cpu < max; cpu++)
+	if (CPU_ISSET_S (cpu, gomp_cpuset_size, cpusetp))
+	  break;
+      sprintf (name, "/sys/devices/system/cpu/cpu%lu/%s", cpu, file);
+      f = fopen (name, "r");
+      if (f != NULL)
+	{
+	  if (getline (&line, &linelen, f) > 0)
+	    key = line;
+	  fclose (f);
+	}
+      for (j = 0; j < ngroups; j++)
+	if ((outer == NULL || outers[j] == outer[i])
+	    && strcmp (keys[j], key) == 0)
+	  break;
+      if (j == ngroups)
+	{
+	  keys[ngroups] = strdup (key);
+	  if (keys[ngroups] == NULL)
+	    gomp_fatal ("Out of memory reading %s topology", file);
+	  outers[ngroups++] = outer ? outer[i] : 0;
+	}
+      group[i] = j;
+    }
+  for (j = 0; j < ngroups; j++)
+    free (keys[j]);
+  free (line);
+  return ngroups;
+}
+
+/* Fill in gomp_places_socket, gomp_places_cache and gomp_places_core from
+   the sysfs topology of the places.  */
+
+static void
+gomp_affinity_init_topology (void)
+{
+  unsigned short *groups;
+
+  if (gomp_places_socket != NULL || gomp_places_list_len == 0)
+    return;
+
+  groups = gomp_malloc (3 * gomp_places_list_len * sizeof (unsigned short));
+  gomp_places_socket = groups;
+  gomp_places_cache = groups + gomp_places_list_len;
+  gomp_places_core = groups + 2 * gomp_places_list_len;
+  gomp_num_sockets
+    = gomp_affinity_group_places ("topology/physical_package_id", NULL,
+				  gomp_places_socket);
+  gomp_affinity_group_places ("cache/index3/shared_cpu_list",
+			      gomp_places_socket, gomp_places_cache);
+  gomp_affinity_group_places ("topology/thread_siblings_list",
+			      gomp_places_cache, gomp_places_core);
+}
+
 void
 gomp_init_affinity (void)
 {
@@ -53,6 +145,8 @@ gomp_init_affinity (void)
 	return;
     }
 
+  gomp_affinity_init_topology ();
+
   struct gomp_thread *thr = gomp_thread ();
   pthread_setaffinity_np (pthread_self (), gomp_cpuset_size,
 			  (cpu_set_t *) gomp_places_list[0]);
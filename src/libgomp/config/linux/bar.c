@@ -27,9 +27,32 @@
    implementation uses atomic instructions and the futex syscall.  */
 
 #include <limits.h>
+#include <string.h>
 #include "wait.h"
 
 
+/* Sleep until the plain barrier BAR leaves generation STATE.  The
+   seq-cst accesses of bar->sleeping and the generation pair with the ones
+   in gomp_barrier_wait_end: either the last thread sees the count, or the
+   sleeper sees the new generation.  */
+
+static void
+gomp_barrier_sleep (gomp_barrier_t *bar, gomp_barrier_state_t state,
+		    unsigned long *est)
+{
+  double start = gomp_spin_sleep_start ();
+
+  do
+    {
+      __atomic_add_fetch (&bar->sleeping, 1, MEMMODEL_SEQ_CST);
+      if (__atomic_load_n (&bar->generation, MEMMODEL_SEQ_CST) == state)
+	futex_wait ((int *) &bar->generation, state);
+      __atomic_sub_fetch (&bar->sleeping, 1, MEMMODEL_RELAXED);
+    }
+  while (__atomic_load_n (&bar->generation, MEMMODEL_ACQUIRE) == state);
+  gomp_spin_sleep_end (est, start);
+}
+
 void
 gomp_barrier_wait_end (gomp_barrier_t *bar, gomp_barrier_state_t state)
 {
@@ -38,17 +61,73 @@ gomp_barrier_wait_end (gomp_barrier_t *bar, gomp_barrier_state_t state)
       /* Next time we'll be awaiting TOTAL threads again.  */
       bar->awaited = bar->total;
       __atomic_store_n (&bar->generation, bar->generation + BAR_INCR,
-			MEMMODEL_RELEASE);
-      futex_wake ((int *) &bar->generation, INT_MAX);
+			MEMMODEL_SEQ_CST);
+      if (__atomic_load_n (&bar->sleeping, MEMMODEL_SEQ_CST))
+	futex_wake ((int *) &bar->generation, INT_MAX);
     }
   else
     {
-      do
-	do_wait ((int *) &bar->generation, state);
-      while (__atomic_load_n (&bar->generation, MEMMODEL_ACQUIRE) == state);
+      unsigned long *est = &gomp_thread ()->barrier_spin_est;
+
+      if (do_spin_adaptive ((int *) &bar->generation, state, est))
+	gomp_barrier_sleep (bar, state, est);
+      else
+	__atomic_thread_fence (MEMMODEL_ACQUIRE);
     }
 }
 
+/* The dock of a thread pool.  Threads arrive on the barrier as usual,
+   but then wait on their own word GO rather than on the generation,
+   until someone stores there the generation that ends this use of the
+   dock with gomp_barrier_undock.  The data of their next team is
+   published by that store, so this is the only way out of the dock:
+   threads that run out of spins sleep on GO, with BAR_DOCK_SLEEPING
+   set in it.  */
+
+#define BAR_DOCK_SLEEPING	1
+
+void
+gomp_barrier_wait_dock (gomp_barrier_t *bar, int *go)
+{
+  gomp_barrier_state_t state = gomp_barrier_wait_start (bar);
+  int target = (state & -BAR_INCR) + BAR_INCR, old;
+  unsigned long *est = &gomp_thread ()->barrier_spin_est;
+  double start;
+
+  if (__builtin_expect (state & BAR_WAS_LAST, 0))
+    gomp_barrier_wait_end (bar, state);
+  if (!do_spin_until (go, target, est))
+    {
+      __atomic_thread_fence (MEMMODEL_ACQUIRE);
+      return;
+    }
+  start = gomp_spin_sleep_start ();
+  old = __atomic_load_n (go, MEMMODEL_ACQUIRE);
+  while (old != target)
+    {
+      if ((old & BAR_DOCK_SLEEPING) == 0
+	  && !__atomic_compare_exchange_n (go, &old, old | BAR_DOCK_SLEEPING,
+					   false, MEMMODEL_ACQUIRE,
+					   MEMMODEL_ACQUIRE))
+	continue;
+      futex_wait (go, old | BAR_DOCK_SLEEPING);
+      old = __atomic_load_n (go, MEMMODEL_ACQUIRE);
+    }
+  gomp_spin_sleep_end (est, start);
+}
+
+/* Let the thread waiting in gomp_barrier_wait_dock on GO out of the
+   dock, once the generation becomes TARGET, see gomp_barrier_dock_target.
+   The thread may be gone by the time the futex is woken, which is
+   harmless.  */
+
+void
+gomp_barrier_undock (int *go, gomp_barrier_state_t target)
+{
+  if (__atomic_exchange_n (go, target, MEMMODEL_RELEASE) & BAR_DOCK_SLEEPING)
+    futex_wake (go, 1);
+}
+
 void
 gomp_barrier_wait (gomp_barrier_t *bar)
 {
@@ -70,23 +149,132 @@ gomp_barrier_wait_last (gomp_barrier_t *bar)
     gomp_barrier_wait_end (bar, state);
 }
 
+/* Threads waiting in a team barrier spin on the generation for a while,
+   as long as the earlier waits of the thread suggest, then sleep
+   on the idle word of their task deque rather than on the generation.
+   The seq-cst store of the word and load of the generation pair with the
+   ones in gomp_team_barrier_wake_idle: either the waker sees the word
+   set, or the waiter sees the new generation.  */
+
+static void
+gomp_team_barrier_idle_wait (gomp_barrier_t *bar, unsigned int generation)
+{
+  struct gomp_thread *thr = gomp_thread ();
+  struct gomp_task_deque *dq = thr->ts.team->task_deques[thr->ts.team_id];
+  int *idle = &dq->idle;
+  double start;
+
+  if (!do_spin_adaptive ((int *) &bar->generation, generation,
+			 &thr->team_barrier_spin_est))
+    return;
+  start = gomp_spin_sleep_start ();
+  __atomic_store_n (idle, 1, MEMMODEL_SEQ_CST);
+  if (__atomic_load_n (&bar->generation, MEMMODEL_SEQ_CST) == generation)
+    futex_wait (idle, 1);
+  __atomic_store_n (idle, 0, MEMMODEL_RELAXED);
+  gomp_spin_sleep_end (&thr->team_barrier_spin_est, start);
+}
+
+/* Wake thread ID of TEAM if it sleeps in gomp_team_barrier_idle_wait.
+   Return true if it did.  */
+
+static inline bool
+gomp_team_barrier_wake_thread (struct gomp_team *team, unsigned int id)
+{
+  int *idle = &team->task_deques[id]->idle;
+
+  if (__atomic_load_n (idle, MEMMODEL_RELAXED) == 1
+      && __atomic_exchange_n (idle, 0, MEMMODEL_ACQ_REL) == 1)
+    {
+      futex_wake (idle, 1);
+      return true;
+    }
+  return false;
+}
+
+/* Wake up to COUNT threads of TEAM sleeping in gomp_team_barrier_idle_wait,
+   or all of them if COUNT is zero.  The caller has just changed the
+   generation.  Threads are tried in order of team_id from the caller's
+   on, so that with close binding the closest ones go first.  */
+
+static void
+gomp_team_barrier_wake_idle (struct gomp_team *team, int count)
+{
+  struct gomp_thread *thr = gomp_thread ();
+  unsigned int nthreads = team->nthreads, i, id;
+
+  __atomic_thread_fence (MEMMODEL_SEQ_CST);
+  id = thr->ts.team == team ? thr->ts.team_id : 0;
+  for (i = 0; i < nthreads; i++)
+    {
+      if (++id >= nthreads)
+	id = 0;
+      if (gomp_team_barrier_wake_thread (team, id) && --count == 0)
+	break;
+    }
+}
+
+/* With a release tree, the thread that completes the barrier only wakes
+   the root of the tree, and every thread leaving the barrier wakes its
+   own children in the tree, so that the wakeups fan out in parallel.
+   Threads still spinning need no wakeup, but wake their children all
+   the same.  */
+
+static void
+gomp_team_barrier_release (gomp_barrier_t *bar, struct gomp_team *team,
+			   unsigned int id)
+{
+  struct gomp_barrier_tree *tree = bar->tree;
+  unsigned int i;
+
+  __atomic_thread_fence (MEMMODEL_SEQ_CST);
+  for (i = tree->wake_start[id]; i < tree->wake_start[id + 1]; i++)
+    gomp_team_barrier_wake_thread (team, tree->wake[i]);
+}
+
+/* Wake all the threads waiting in the team barrier BAR of TEAM, after
+   the caller has completed it.  */
+
+static void
+gomp_team_barrier_wake_all (gomp_barrier_t *bar, struct gomp_team *team)
+{
+  if (__builtin_expect (bar->tree == NULL, 1))
+    gomp_team_barrier_wake_idle (team, 0);
+  else
+    {
+      __atomic_thread_fence (MEMMODEL_SEQ_CST);
+      gomp_team_barrier_wake_thread (team, bar->tree->root);
+    }
+}
+
+/* Wake COUNT threads waiting in the team barrier BAR because there are
+   tasks to run, or all of them if COUNT is zero.  Only idle threads are
+   woken; those still spinning see BAR_TASK_PENDING by themselves.  */
+
 void
 gomp_team_barrier_wake (gomp_barrier_t *bar, int count)
 {
-  futex_wake ((int *) &bar->generation, count == 0 ? INT_MAX : count);
+  struct gomp_team *team = gomp_thread ()->ts.team;
+
+  if (count == 0)
+    gomp_team_barrier_wake_all (bar, team);
+  else
+    gomp_team_barrier_wake_idle (team, count);
 }
 
 void
 gomp_team_barrier_wait_end (gomp_barrier_t *bar, gomp_barrier_state_t state)
 {
+  /* Once the barrier is released, the master may already be setting up
+     the next team for this thread, so don't look at thr->ts then.  */
+  struct gomp_thread *thr = gomp_thread ();
+  struct gomp_team *team = thr->ts.team;
+  unsigned int id = thr->ts.team_id;
   unsigned int generation, gen;
 
   if (__builtin_expect (state & BAR_WAS_LAST, 0))
     {
       /* Next time we'll be awaiting TOTAL threads again.  */
-      struct gomp_thread *thr = gomp_thread ();
-      struct gomp_team *team = thr->ts.team;
-
       bar->awaited = bar->total;
       team->work_share_cancelled = 0;
       if (__builtin_expect (team->task_count, 0))
@@ -99,7 +287,9 @@ gomp_team_barrier_wait_end (gomp_barrier_t *bar, gomp_barrier_state_t state)
 	  state &= ~BAR_CANCELLED;
 	  state += BAR_INCR - BAR_WAS_LAST;
 	  __atomic_store_n (&bar->generation, state, MEMMODEL_RELEASE);
-	  futex_wake ((int *) &bar->generation, INT_MAX);
+	  gomp_team_barrier_wake_all (bar, team);
+	  if (__builtin_expect (bar->tree != NULL, 0))
+	    gomp_team_barrier_release (bar, team, id);
 	  return;
 	}
     }
@@ -108,7 +298,7 @@ gomp_team_barrier_wait_end (gomp_barrier_t *bar, gomp_barrier_state_t state)
   state &= ~BAR_CANCELLED;
   do
     {
-      do_wait ((int *) &bar->generation, generation);
+      gomp_team_barrier_idle_wait (bar, generation);
       gen = __atomic_load_n (&bar->generation, MEMMODEL_ACQUIRE);
       if (__builtin_expect (gen & BAR_TASK_PENDING, 0))
 	{
@@ -118,12 +308,15 @@ gomp_team_barrier_wait_end (gomp_barrier_t *bar, gomp_barrier_state_t state)
       generation |= gen & BAR_WAITING_FOR_TASK;
     }
   while (gen != state + BAR_INCR);
+
+  if (__builtin_expect (bar->tree != NULL, 0))
+    gomp_team_barrier_release (bar, team, id);
 }
 
 void
 gomp_team_barrier_wait (gomp_barrier_t *bar)
 {
-  gomp_team_barrier_wait_end (bar, gomp_barrier_wait_start (bar));
+  gomp_team_barrier_wait_end (bar, gomp_team_barrier_wait_start (bar));
 }
 
 void
@@ -139,6 +332,9 @@ bool
 gomp_team_barrier_wait_cancel_end (gomp_barrier_t *bar,
 				   gomp_barrier_state_t state)
 {
+  struct gomp_thread *thr = gomp_thread ();
+  struct gomp_team *team = thr->ts.team;
+  unsigned int id = thr->ts.team_id;
   unsigned int generation, gen;
 
   if (__builtin_expect (state & BAR_WAS_LAST, 0))
@@ -148,9 +344,6 @@ gomp_team_barrier_wait_cancel_end (gomp_barrier_t *bar,
 	 cancellation means that at least one of the threads has been
 	 cancelled, thus on a cancellable barrier we should never see
 	 all threads to arrive.  */
-      struct gomp_thread *thr = gomp_thread ();
-      struct gomp_team *team = thr->ts.team;
-
       bar->awaited = bar->total;
       team->work_share_cancelled = 0;
       if (__builtin_expect (team->task_count, 0))
@@ -162,7 +355,9 @@ gomp_team_barrier_wait_cancel_end (gomp_barrier_t *bar,
 	{
 	  state += BAR_INCR - BAR_WAS_LAST;
 	  __atomic_store_n (&bar->generation, state, MEMMODEL_RELEASE);
-	  futex_wake ((int *) &bar->generation, INT_MAX);
+	  gomp_team_barrier_wake_all (bar, team);
+	  if (__builtin_expect (bar->tree != NULL, 0))
+	    gomp_team_barrier_release (bar, team, id);
 	  return false;
 	}
     }
@@ -173,7 +368,7 @@ gomp_team_barrier_wait_cancel_end (gomp_barrier_t *bar,
   generation = state;
   do
     {
-      do_wait ((int *) &bar->generation, generation);
+      gomp_team_barrier_idle_wait (bar, generation);
       gen = __atomic_load_n (&bar->generation, MEMMODEL_ACQUIRE);
       if (__builtin_expect (gen & BAR_CANCELLED, 0))
 	return true;
@@ -186,13 +381,16 @@ gomp_team_barrier_wait_cancel_end (gomp_barrier_t *bar,
     }
   while (gen != state + BAR_INCR);
 
+  if (__builtin_expect (bar->tree != NULL, 0))
+    gomp_team_barrier_release (bar, team, id);
   return false;
 }
 
 bool
 gomp_team_barrier_wait_cancel (gomp_barrier_t *bar)
 {
-  return gomp_team_barrier_wait_cancel_end (bar, gomp_barrier_wait_start (bar));
+  return gomp_team_barrier_wait_cancel_end (bar,
+					    gomp_team_barrier_wait_start (bar));
 }
 
 void
@@ -206,5 +404,385 @@ gomp_team_barrier_cancel (struct gomp_team *team)
     }
   team->barrier.generation |= BAR_CANCELLED;
   gomp_mutex_unlock (&team->task_lock);
-  futex_wake ((int *) &team->barrier.generation, INT_MAX);
+  /* Not every thread may get to the barrier after a cancellation, so
+     don't rely on the release tree here.  */
+  gomp_team_barrier_wake_idle (team, 0);
+}
+
+
+/* With GOMP_BARRIER=tree or topology, threads don't all decrement
+   bar->awaited on arrival at a team barrier, but counters in a combining
+   tree, each in its own cacheline; only the last thread to arrive at a
+   node goes on to its parent, and the one that completes the root
+   completes the barrier.  The generation word, with its task pending and
+   cancellation flags, is still used for the release.
+
+   The tree is built bottom up, one level at a time, from a list of
+   entities, which are threads or nodes of the levels built so far.  Each
+   run of entities with the same key becomes a node of the new level;
+   an entity alone in its run stays as it is.  An entity numbered below
+   COUNT is that thread, any other is node ENTITY - COUNT.  */
+
+#define GOMP_BARRIER_FANIN 4
+
+struct gomp_barrier_build
+{
+  struct gomp_barrier_tree *tree;
+  unsigned count;
+  unsigned nnodes;
+  unsigned nentities;
+  unsigned nchildren;
+  unsigned *entities;
+  /* REP[K] is the first thread in the arrival order under node K; it is
+     the thread that wakes the other threads under node K on release.  */
+  unsigned *rep;
+};
+
+static inline unsigned
+gomp_barrier_build_rep (struct gomp_barrier_build *b, unsigned entity)
+{
+  return entity < b->count ? entity : b->rep[entity - b->count];
+}
+
+/* Build a level of the tree in B.  The key of an entity is KEYS of its
+   representative shifted right by SHIFT or, if KEYS is NULL, its position
+   divided by GOMP_BARRIER_FANIN.  */
+
+static void
+gomp_barrier_build_level (struct gomp_barrier_build *b,
+			  const unsigned long long *keys, int shift)
+{
+  struct gomp_barrier_node *nodes = b->tree->nodes;
+  unsigned i, j, l, k, n = 0;
+
+  for (i = 0; i < b->nentities; i = j)
+    {
+      if (keys == NULL)
+	j = i - i % GOMP_BARRIER_FANIN + GOMP_BARRIER_FANIN;
+      else
+	{
+	  unsigned long long key
+	    = keys[gomp_barrier_build_rep (b, b->entities[i])] >> shift;
+	  for (j = i + 1; j < b->nentities; j++)
+	    if (keys[gomp_barrier_build_rep (b, b->entities[j])] >> shift
+		!= key)
+	      break;
+	}
+      if (j > b->nentities)
+	j = b->nentities;
+      if (j - i == 1)
+	{
+	  b->entities[n++] = b->entities[i];
+	  continue;
+	}
+
+      k = b->nnodes++;
+      nodes[k].count = j - i;
+      nodes[k].total = j - i;
+      nodes[k].parent = ~0U;
+      b->rep[k] = gomp_barrier_build_rep (b, b->entities[i]);
+      b->tree->child_start[k] = b->nchildren;
+      for (l = i; l < j; l++)
+	{
+	  if (b->entities[l] < b->count)
+	    b->tree->leaf[b->entities[l]] = k;
+	  else
+	    nodes[b->entities[l] - b->count].parent = k;
+	  b->tree->children[b->nchildren++] = b->entities[l];
+	}
+      b->entities[n++] = b->count + k;
+    }
+  b->nentities = n;
+}
+
+/* Give the team barrier BAR a tree for its COUNT threads, which arrive in
+   the order ORDER.  If KEYS is non-NULL, the lowest levels group the
+   threads by the 16-bit fields of their KEYS, lowest field first, and
+   GOMP_BARRIER_FANIN entities per node are only used above those.  */
+
+static void
+gomp_barrier_build_tree (gomp_barrier_t *bar, unsigned count,
+			 const unsigned *order,
+			 const unsigned long long *keys)
+{
+  struct gomp_barrier_build b;
+  struct gomp_barrier_tree *tree;
+  struct gomp_barrier_node *nodes;
+  unsigned entities[count], rep[count];
+  unsigned i, k;
+  int shift;
+
+  /* A tree of COUNT leaves and at least two children per node has at
+     most COUNT - 1 nodes, and so at most 2 * COUNT - 2 children.  */
+  tree = gomp_malloc (sizeof (*tree) + 6 * count * sizeof (unsigned));
+  nodes = gomp_aligned_alloc (64, (count - 1) * sizeof (*nodes));
+  tree->nodes = nodes;
+  tree->leaf = (unsigned *) (tree + 1);
+  tree->wake_start = tree->leaf + count;
+  tree->wake = tree->wake_start + count + 1;
+  tree->child_start = tree->wake + count - 1;
+  tree->children = tree->child_start + count;
+
+  b.tree = tree;
+  b.count = count;
+  b.nnodes = 0;
+  b.nentities = count;
+  b.nchildren = 0;
+  b.entities = entities;
+  b.rep = rep;
+  for (i = 0; i < count; i++)
+    entities[i] = order ? order[i] : i;
+  if (keys)
+    for (shift = 0; shift < 64 && b.nentities > 1; shift += 16)
+      gomp_barrier_build_level (&b, keys, shift);
+  while (b.nentities > 1)
+    gomp_barrier_build_level (&b, NULL, 0);
+
+  /* With a single node, that's just bar->awaited in another cacheline.  */
+  if (b.nnodes <= 1)
+    {
+      gomp_aligned_free (nodes);
+      free (tree);
+      return;
+    }
+  tree->root = rep[b.nnodes - 1];
+  tree->nnodes = b.nnodes;
+  tree->child_start[b.nnodes] = b.nchildren;
+
+  /* The representative of a node wakes the representatives of its other
+     children.  The nodes were built bottom up, so fill in the lists going
+     down from the root, so that the wakeups for the biggest subtrees go
+     out first.  WAKE_START[I] serves as the fill position for thread I,
+     and is shifted back into place afterwards.  */
+  memset (tree->wake_start, 0, (count + 1) * sizeof (unsigned));
+  for (k = 0; k < b.nnodes - 1; k++)
+    if (rep[k] != rep[nodes[k].parent])
+      tree->wake_start[rep[nodes[k].parent] + 1]++;
+  for (i = 0; i < count; i++)
+    if (rep[tree->leaf[i]] != i)
+      tree->wake_start[rep[tree->leaf[i]] + 1]++;
+  for (i = 1; i < count; i++)
+    tree->wake_start[i + 1] += tree->wake_start[i];
+  for (k = b.nnodes - 1; k-- > 0; )
+    if (rep[k] != rep[nodes[k].parent])
+      tree->wake[tree->wake_start[rep[nodes[k].parent]]++] = rep[k];
+  for (i = 0; i < count; i++)
+    if (rep[tree->leaf[i]] != i)
+      tree->wake[tree->wake_start[rep[tree->leaf[i]]]++] = i;
+  for (i = count; i > 0; i--)
+    tree->wake_start[i] = tree->wake_start[i - 1];
+  tree->wake_start[0] = 0;
+
+  bar->tree = tree;
+}
+
+/* Set up the team barrier BAR for COUNT threads.  With
+   GOMP_BARRIER=topology and a places list, the tree can only be built
+   once the places of the threads are known, by
+   gomp_team_barrier_init_places.  */
+
+void
+gomp_team_barrier_init (gomp_barrier_t *bar, unsigned count)
+{
+  gomp_barrier_init (bar, count);
+  if (gomp_barrier_var == GOMP_BARRIER_CENTRAL
+      || count <= GOMP_BARRIER_FANIN
+      || (gomp_barrier_var == GOMP_BARRIER_TOPOLOGY
+	  && gomp_places_list != NULL))
+    return;
+  gomp_barrier_build_tree (bar, count, NULL, NULL);
+}
+
+/* Set up the team barrier BAR again for a team reused by gomp_new_team,
+   with as many threads as before.  A tree depending only on the number
+   of threads is kept, with its counters reset in case the last team was
+   cancelled in the middle of a barrier; one built from the places of
+   the threads is left to gomp_team_barrier_init_places.  */
+
+void
+gomp_team_barrier_reset (gomp_barrier_t *bar)
+{
+  struct gomp_barrier_tree *tree = bar->tree;
+  unsigned k;
+
+  if (tree != NULL
+      && gomp_barrier_var == GOMP_BARRIER_TOPOLOGY
+      && gomp_places_list != NULL)
+    {
+      gomp_barrier_free_tree (bar);
+      tree = NULL;
+    }
+  gomp_barrier_init (bar, bar->total);
+  if (tree != NULL)
+    for (k = 0; k < tree->nnodes; k++)
+      tree->nodes[k].count = tree->nodes[k].total;
+  bar->tree = tree;
+}
+
+/* Compare two threads by their topology keys, for qsort.  */
+
+struct gomp_barrier_place
+{
+  unsigned long long key;
+  unsigned id;
+};
+
+static int
+gomp_barrier_place_cmp (const void *p, const void *q)
+{
+  const struct gomp_barrier_place *a = p, *b = q;
+
+  if (a->key != b->key)
+    return a->key < b->key ? -1 : 1;
+  return a->id < b->id ? -1 : a->id > b->id;
+}
+
+/* Give the team barrier BAR, just set up by gomp_team_barrier_init, a
+   tree following the machine topology, given that thread I of the team
+   is bound to place PLACES[I] (counting from 1, as thr->place).  Threads
+   in the same place are grouped first, then those on the same core, the
+   same last level cache and the same socket, so that only one thread of
+   each group touches the cachelines of the level above.  */
+
+void
+gomp_team_barrier_init_places (gomp_barrier_t *bar, const unsigned *places)
+{
+  unsigned count = bar->total, i;
+  struct gomp_barrier_place sorted[count];
+  unsigned long long keys[count];
+  unsigned order[count];
+
+  if (count <= 1 || gomp_places_socket == NULL)
+    return;
+  for (i = 0; i < count; i++)
+    {
+      unsigned p = places[i] - 1;
+
+      if (places[i] == 0)
+	{
+	  gomp_barrier_build_tree (bar, count, NULL, NULL);
+	  return;
+	}
+      keys[i] = ((unsigned long long) gomp_places_socket[p] << 48
+		 | (unsigned long long) gomp_places_cache[p] << 32
+		 | (unsigned long long) gomp_places_core[p] << 16
+		 | (p & 0xffff));
+      sorted[i].key = keys[i];
+      sorted[i].id = i;
+    }
+  qsort (sorted, count, sizeof (sorted[0]), gomp_barrier_place_cmp);
+  for (i = 0; i < count; i++)
+    order[i] = sorted[i].id;
+  gomp_barrier_build_tree (bar, count, order, keys);
+}
+
+void
+gomp_barrier_free_tree (gomp_barrier_t *bar)
+{
+  gomp_aligned_free (bar->tree->nodes);
+  free (bar->tree);
+  bar->tree = NULL;
+}
+
+/* Arrive at the team barrier BAR through its combining tree, as thread ID
+   of TEAM.  Return true if the calling thread is the last one to arrive.
+   The last thread to arrive at a node resets its counter for the next
+   barrier; nobody else can get to the node again before the barrier is
+   released.  If COMBINE is non-NULL, that thread also combines the
+   values of the children of the node with it, and the last thread
+   stores the value of the root in *RESULT.  */
+
+static bool
+gomp_barrier_tree_arrive_1 (gomp_barrier_t *bar, struct gomp_team *team,
+			    unsigned id, gomp_barrier_combine_fn combine,
+			    gomp_barrier_value_t *result)
+{
+  struct gomp_barrier_tree *tree = bar->tree;
+  struct gomp_barrier_node *node;
+  unsigned k = tree->leaf[id];
+
+  do
+    {
+      node = &tree->nodes[k];
+
+      /* As in gomp_barrier_wait_start, this is also the memory barrier
+	 needed for the implicit flush.  */
+      if (__atomic_add_fetch (&node->count, -1, MEMMODEL_ACQ_REL) != 0)
+	return false;
+      node->count = node->total;
+      if (combine)
+	{
+	  unsigned i;
+
+	  for (i = tree->child_start[k]; i < tree->child_start[k + 1]; i++)
+	    {
+	      unsigned c = tree->children[i];
+	      gomp_barrier_value_t *value
+		= c < bar->total ? &team->barrier_slots[c].partial
+		  : &tree->nodes[c - bar->total].value;
+
+	      if (i == tree->child_start[k])
+		node->value = *value;
+	      else
+		combine (&node->value, value);
+	    }
+	}
+      k = node->parent;
+    }
+  while (k != ~0U);
+  if (combine)
+    *result = node->value;
+  return true;
+}
+
+bool
+gomp_barrier_tree_arrive (gomp_barrier_t *bar)
+{
+  struct gomp_thread *thr = gomp_thread ();
+
+  return gomp_barrier_tree_arrive_1 (bar, thr->ts.team, thr->ts.team_id,
+				     NULL, NULL);
+}
+
+/* Wait at the team barrier BAR, combining the *VALUE of all the threads
+   with COMBINE, and store the result in *VALUE of each of them.  The
+   values are combined up the arrival tree by the last thread to arrive at
+   each node, or all by the last thread to arrive without a tree, and the
+   result is passed on with the release.  Results of consecutive barriers
+   go to different slots, as a thread may read its result only once the
+   next barrier has started.  */
+
+void
+gomp_team_barrier_reduce (gomp_barrier_t *bar, gomp_barrier_value_t *value,
+			  gomp_barrier_combine_fn combine)
+{
+  struct gomp_thread *thr = gomp_thread ();
+  struct gomp_team *team = thr->ts.team;
+  gomp_barrier_value_t *result;
+  gomp_barrier_state_t state;
+  unsigned i;
+
+  team->barrier_slots[thr->ts.team_id].partial = *value;
+  if (bar->tree == NULL)
+    {
+      state = gomp_barrier_wait_start (bar);
+      result = &bar->result[(state / BAR_INCR) & 1];
+      if (state & BAR_WAS_LAST)
+	{
+	  *result = team->barrier_slots[0].partial;
+	  for (i = 1; i < bar->total; i++)
+	    combine (result, &team->barrier_slots[i].partial);
+	}
+    }
+  else
+    {
+      state = __atomic_load_n (&bar->generation, MEMMODEL_ACQUIRE);
+      state &= -BAR_INCR | BAR_CANCELLED;
+      result = &bar->result[(state / BAR_INCR) & 1];
+      if (gomp_barrier_tree_arrive_1 (bar, team, thr->ts.team_id, combine,
+				      result))
+	state |= BAR_WAS_LAST;
+    }
+  gomp_team_barrier_wait_end (bar, state);
+  *value = *result;
 }
@@ -31,14 +31,57 @@
 
 #include "mutex.h"
 
+/* A node of the combining tree of a team barrier.  COUNT is the number of
+   arrivals still expected at the node in the current barrier, out of
+   TOTAL; PARENT is the index of the parent node, or ~0U for the root.
+   In gomp_team_barrier_reduce, VALUE is the combined value of the threads
+   under the node.  Every node sits in its own cacheline.  */
+
+struct gomp_barrier_node
+{
+  unsigned count;
+  unsigned total;
+  unsigned parent;
+  gomp_barrier_value_t value;
+} __attribute__((aligned (64)));
+
+/* The combining tree used for arrival at a team barrier with
+   GOMP_BARRIER=tree, and the matching release tree.  Thread I arrives at
+   node LEAF[I].  When released, it wakes the sleeping threads
+   WAKE[WAKE_START[I]] to WAKE[WAKE_START[I + 1] - 1], which in turn wake
+   theirs.  ROOT is the thread the releasing thread starts with.  The
+   children of node K are CHILDREN[CHILD_START[K]] to
+   CHILDREN[CHILD_START[K + 1] - 1], numbered as in
+   gomp_barrier_build_level.  */
+
+struct gomp_barrier_tree
+{
+  struct gomp_barrier_node *nodes;
+  unsigned *leaf;
+  unsigned *wake_start;
+  unsigned *wake;
+  unsigned *child_start;
+  unsigned *children;
+  unsigned root;
+  unsigned nnodes;
+};
+
 typedef struct
 {
   /* Make sure total/generation is in a mostly read cacheline, while
      awaited in a separate cacheline.  */
   unsigned total __attribute__((aligned (64)));
   unsigned generation;
+  struct gomp_barrier_tree *tree;
+  /* The results of gomp_team_barrier_reduce, for even and odd
+     generations.  */
+  gomp_barrier_value_t result[2];
   unsigned awaited __attribute__((aligned (64)));
   unsigned awaited_final;
+  /* Number of threads sleeping on the generation of a plain barrier, so
+     that the last thread to arrive can skip the futex wake if there are
+     none.  */
+  unsigned sleeping;
 } gomp_barrier_t;
 
 typedef unsigned int gomp_barrier_state_t;
@@ -58,6 +101,8 @@ static inline void gomp_barrier_init (gomp_barrier_t *bar, unsigned count)
   bar->awaited = count;
   bar->awaited_final = count;
   bar->generation = 0;
+  bar->sleeping = 0;
+  bar->tree = NULL;
 }
 
 static inline void gomp_barrier_reinit (gomp_barrier_t *bar, unsigned count)
@@ -66,13 +111,24 @@ static inline void gomp_barrier_reinit (gomp_barrier_t *bar, unsigned count)
   bar->total = count;
 }
 
+extern void gomp_barrier_free_tree (gomp_barrier_t *);
+
 static inline void gomp_barrier_destroy (gomp_barrier_t *bar)
 {
+  if (__builtin_expect (bar->tree != NULL, 0))
+    gomp_barrier_free_tree (bar);
 }
 
+extern void gomp_team_barrier_init (gomp_barrier_t *, unsigned);
+extern void gomp_team_barrier_init_places (gomp_barrier_t *,
+					   const unsigned *);
+extern void gomp_team_barrier_reset (gomp_barrier_t *);
+extern bool gomp_barrier_tree_arrive (gomp_barrier_t *);
 extern void gomp_barrier_wait (gomp_barrier_t *);
 extern void gomp_barrier_wait_last (gomp_barrier_t *);
 extern void gomp_barrier_wait_end (gomp_barrier_t *, gomp_barrier_state_t);
+extern void gomp_barrier_wait_dock (gomp_barrier_t *, int *);
+extern void gomp_barrier_undock (int *, gomp_barrier_state_t);
 extern void gomp_team_barrier_wait (gomp_barrier_t *);
 extern void gomp_team_barrier_wait_final (gomp_barrier_t *);
 extern void gomp_team_barrier_wait_end (gomp_barrier_t *,
@@ -81,6 +137,8 @@ extern bool gomp_team_barrier_wait_cancel (gomp_barrier_t *);
 extern bool gomp_team_barrier_wait_cancel_end (gomp_barrier_t *,
 					       gomp_barrier_state_t);
 extern void gomp_team_barrier_wake (gomp_barrier_t *, int);
+extern void gomp_team_barrier_reduce (gomp_barrier_t *, gomp_barrier_value_t *,
+				      gomp_barrier_combine_fn);
 struct gomp_team;
 extern void gomp_team_barrier_cancel (struct gomp_team *);
 
@@ -105,6 +163,57 @@ gomp_barrier_wait_cancel_start (gomp_barrier_t *bar)
   return gomp_barrier_wait_start (bar);
 }
 
+/* This is like gomp_barrier_wait_start, but for the barriers of a team
+   only, which may arrive through the combining tree instead of on
+   bar->awaited.  */
+static inline gomp_barrier_state_t
+gomp_team_barrier_wait_start (gomp_barrier_t *bar)
+{
+  unsigned int ret;
+
+  if (__builtin_expect (bar->tree == NULL, 1))
+    return gomp_barrier_wait_start (bar);
+  ret = __atomic_load_n (&bar->generation, MEMMODEL_ACQUIRE);
+  ret &= -BAR_INCR | BAR_CANCELLED;
+  if (gomp_barrier_tree_arrive (bar))
+    ret |= BAR_WAS_LAST;
+  return ret;
+}
+
+static inline gomp_barrier_state_t
+gomp_team_barrier_wait_cancel_start (gomp_barrier_t *bar)
+{
+  return gomp_team_barrier_wait_start (bar);
+}
+
+/* The two halves of omp_barrier_arrive and omp_barrier_wait.  A thread
+   that isn't the last to arrive holds nothing in between, so they are
+   just the two halves of gomp_team_barrier_wait.  */
+
+static inline gomp_barrier_state_t
+gomp_team_barrier_arrive (gomp_barrier_t *bar)
+{
+  return gomp_team_barrier_wait_start (bar);
+}
+
+static inline void
+gomp_team_barrier_wait_arrived (gomp_barrier_t *bar,
+				gomp_barrier_state_t state)
+{
+  gomp_team_barrier_wait_end (bar, state);
+}
+
+/* The generation that ends the current use of the dock BAR, for
+   gomp_barrier_undock, as seen by a thread that hasn't arrived there
+   yet.  */
+
+static inline gomp_barrier_state_t
+gomp_barrier_dock_target (gomp_barrier_t *bar)
+{
+  return ((__atomic_load_n (&bar->generation, MEMMODEL_RELAXED) & -BAR_INCR)
+	  + BAR_INCR);
+}
+
 /* This is like gomp_barrier_wait_start, except it decrements
    bar->awaited_final rather than bar->awaited and should be used
    for the gomp_team_end barrier only.  */
@@ -146,6 +255,16 @@ gomp_team_barrier_set_waiting_for_tasks (gomp_barrier_t *bar)
   bar->generation |= BAR_WAITING_FOR_TASK;
 }
 
+/* Unlike the other inlines, this one may be called without
+   team->task_lock held.  */
+
+static inline bool
+gomp_team_barrier_task_pending (gomp_barrier_t *bar)
+{
+  return (__atomic_load_n (&bar->generation, MEMMODEL_SEQ_CST)
+	  & BAR_TASK_PENDING) != 0;
+}
+
 static inline bool
 gomp_team_barrier_waiting_for_tasks (gomp_barrier_t *bar)
 {
@@ -31,18 +31,30 @@
 long int gomp_futex_wake = FUTEX_WAKE | FUTEX_PRIVATE_FLAG;
 long int gomp_futex_wait = FUTEX_WAIT | FUTEX_PRIVATE_FLAG;
 
+/* The adaptive spin estimate is the locking thread's, see do_spin_adaptive;
+   a mutex is a bare int with no room for one.  Without TLS, threads that
+   libgomp didn't create have no gomp_thread and start from scratch.  */
+
 void
 gomp_mutex_lock_slow (gomp_mutex_t *mutex, int oldval)
 {
+  struct gomp_thread *thr = gomp_thread ();
+  unsigned long local_est = 0;
+  unsigned long *est = thr ? &thr->mutex_spin_est : &local_est;
+  bool slept = false;
+  double start = 0.0;
+
   /* First loop spins a while.  */
   while (oldval == 1)
     {
-      if (do_spin (mutex, 1))
+      if (do_spin_adaptive (mutex, 1, est))
 	{
 	  /* Spin timeout, nothing changed.  Set waiting flag.  */
 	  oldval = __atomic_exchange_n (mutex, -1, MEMMODEL_ACQUIRE);
 	  if (oldval == 0)
 	    return;
+	  start = gomp_spin_sleep_start ();
+	  slept = true;
 	  futex_wait (mutex, -1);
 	  break;
 	}
@@ -59,7 +71,17 @@ gomp_mutex_lock_slow (gomp_mutex_t *mutex, int oldval)
   /* Second loop waits until mutex is unlocked.  We always exit this
      loop with wait flag set, so next unlock will awaken a thread.  */
   while ((oldval = __atomic_exchange_n (mutex, -1, MEMMODEL_ACQUIRE)))
-    do_wait (mutex, -1);
+    if (do_spin_adaptive (mutex, -1, est))
+      {
+	if (!slept)
+	  {
+	    start = gomp_spin_sleep_start ();
+	    slept = true;
+	  }
+	futex_wait (mutex, -1);
+      }
+  if (slept)
+    gomp_spin_sleep_end (est, start);
 }
 
 void
@@ -0,0 +1,69 @@
+/* Copyright (C) 2014 Free Software Foundation, Inc.
+
+   This file is part of the GNU OpenMP Library (libgomp).
+
+   Libgomp is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   Libgomp is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+   FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+   more details.
+
+   Under Section 7 of GPL version 3, you are granted additional
+   permissions described in the GCC Runtime Library Exception, version
+   3.1, as published by the Free Software Foundation.
+
+   You should have received a copy of the GNU General Public License and
+   a copy of the GCC Runtime Library Exception along with this program;
+   see the files COPYING3 and COPYING.RUNTIME respectively.  If not, see
+   <http://www.gnu.org/licenses/>.  */
+
+
+/* This is a Linux specific implementation of the ticket hand-off used
+   by ORDERED sections and the work share ring.  This type is private to
+   the library.  A waiter spins until the "now serving" counter reaches
+   its ticket and falls back to the futex syscall once the spin count is
+   exhausted.  */
+
+#ifndef GOMP_TICKET_H
+#define GOMP_TICKET_H 1
+
+#include "wait.h"
+#include <limits.h>
+
+/* Wait until *SERVING reaches TICKET.  *SERVING only ever grows, modulo
+   wrap-around.  *SLEEPERS counts the threads blocked in the kernel, so
+   that gomp_ticket_serve only has to make the futex syscall when
+   somebody actually sleeps.  */
+
+static inline void
+gomp_ticket_wait (unsigned *serving, int *sleepers, unsigned ticket)
+{
+  unsigned cur;
+
+  while ((int) ((cur = __atomic_load_n (serving, MEMMODEL_ACQUIRE))
+		- ticket) < 0)
+    if (do_spin ((int *) serving, (int) cur))
+      {
+	__atomic_add_fetch (sleepers, 1, MEMMODEL_SEQ_CST);
+	futex_wait ((int *) serving, (int) cur);
+	__atomic_sub_fetch (sleepers, 1, MEMMODEL_RELAXED);
+      }
+}
+
+/* Let the holder of TICKET proceed.  Every blocked waiter is woken, as
+   they all sleep on the same word; those whose turn hasn't come yet go
+   back to spinning.  */
+
+static inline void
+gomp_ticket_serve (unsigned *serving, int *sleepers, unsigned ticket)
+{
+  __atomic_store_n (serving, ticket, MEMMODEL_SEQ_CST);
+  if (__atomic_load_n (sleepers, MEMMODEL_SEQ_CST) != 0)
+    futex_wake ((int *) serving, INT_MAX);
+}
+
+#endif /* GOMP_TICKET_H */
@@ -31,6 +31,7 @@
 
 #include "libgomp.h"
 #include <errno.h>
+#include <limits.h>
 
 #define FUTEX_WAIT	0
 #define FUTEX_WAKE	1
@@ -64,6 +65,106 @@ static inline void do_wait (int *addr, int val)
     futex_wait (addr, val);
 }
 
+/* Adaptive spinning, with GOMP_SPIN_ADAPTIVE.  *EST is a moving average
+   of how long the waits at one barrier or mutex last, counted in spins.
+   Sleeps are timed with omp_get_wtime and converted at the rough rate of
+   100000 spins per msec also assumed for GOMP_SPINCOUNT.  A waiter spins
+   for twice the expected wait, but doesn't spin beyond a few
+   GOMP_SPIN_ADAPTIVE_MIN spins if the expected wait exceeds the
+   GOMP_SPINCOUNT limit, as it would have to sleep anyway.  */
+
+#define GOMP_SPIN_ADAPTIVE_MIN	100
+#define GOMP_SPINS_PER_SEC	100000000.0
+
+static inline unsigned long long
+gomp_spin_budget (unsigned long est)
+{
+  unsigned long long count = gomp_spin_count_var;
+
+  if (__builtin_expect (gomp_managed_threads > gomp_available_cpus, 0))
+    count = gomp_throttled_spin_count_var;
+  if (est >= count)
+    est = 0;
+  if (count > 2ULL * est + GOMP_SPIN_ADAPTIVE_MIN)
+    count = 2ULL * est + GOMP_SPIN_ADAPTIVE_MIN;
+  return count;
+}
+
+static inline void
+gomp_spin_update (unsigned long *est, unsigned long long spins)
+{
+  unsigned long old = __atomic_load_n (est, MEMMODEL_RELAXED);
+
+  if (spins > ULONG_MAX / 2)
+    spins = ULONG_MAX / 2;
+  __atomic_store_n (est, old + ((long) spins - (long) old) / 8,
+		    MEMMODEL_RELAXED);
+}
+
+/* Like do_spin, but spin for the budget given by *EST, and account for
+   the wait if it ends while spinning.  */
+
+static inline int do_spin_adaptive (int *addr, int val, unsigned long *est)
+{
+  unsigned long long i, count;
+
+  if (!gomp_spin_adaptive_var)
+    return do_spin (addr, val);
+  count = gomp_spin_budget (__atomic_load_n (est, MEMMODEL_RELAXED));
+  for (i = 0; i < count; i++)
+    if (__builtin_expect (__atomic_load_n (addr, MEMMODEL_RELAXED) != val, 0))
+      {
+	gomp_spin_update (est, i);
+	return 0;
+      }
+    else
+      cpu_relax ();
+  return 1;
+}
+
+/* The other way around, spin until *ADDR becomes VAL.  Return 1 if it
+   didn't within the budget.  */
+
+static inline int do_spin_until (int *addr, int val, unsigned long *est)
+{
+  unsigned long long i, count = gomp_spin_count_var;
+
+  if (__builtin_expect (gomp_managed_threads > gomp_available_cpus, 0))
+    count = gomp_throttled_spin_count_var;
+  if (gomp_spin_adaptive_var)
+    count = gomp_spin_budget (__atomic_load_n (est, MEMMODEL_RELAXED));
+  for (i = 0; i < count; i++)
+    if (__builtin_expect (__atomic_load_n (addr, MEMMODEL_RELAXED) == val, 0))
+      {
+	if (gomp_spin_adaptive_var)
+	  gomp_spin_update (est, i);
+	return 0;
+      }
+    else
+      cpu_relax ();
+  return 1;
+}
+
+/* After do_spin_adaptive or do_spin_until gave up, time the sleep that
+   follows, from the value returned by gomp_spin_sleep_start to the call
+   of gomp_spin_sleep_end, and account for it in *EST.  */
+
+static inline double gomp_spin_sleep_start (void)
+{
+  return gomp_spin_adaptive_var ? omp_get_wtime () : 0.0;
+}
+
+static inline void gomp_spin_sleep_end (unsigned long *est, double start)
+{
+  unsigned long old;
+
+  if (!gomp_spin_adaptive_var)
+    return;
+  old = __atomic_load_n (est, MEMMODEL_RELAXED);
+  gomp_spin_update (est, gomp_spin_budget (old)
+			 + (omp_get_wtime () - start) * GOMP_SPINS_PER_SEC);
+}
+
 #ifdef HAVE_ATTRIBUTE_VISIBILITY
 # pragma GCC visibility pop
 #endif
@@ -26,6 +26,11 @@
 
 #include "libgomp.h"
 
+unsigned short *gomp_places_socket;
+unsigned long gomp_num_sockets = 1;
+unsigned short *gomp_places_cache;
+unsigned short *gomp_places_core;
+
 void
 gomp_init_affinity (void)
 {
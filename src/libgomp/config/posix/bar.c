@@ -28,6 +28,7 @@
    POSIX pthread_barrier_t won't work.  */
 
 #include "libgomp.h"
+#include <sched.h>
 
 
 void
@@ -76,6 +77,7 @@ gomp_barrier_wait_end (gomp_barrier_t *bar, gomp_barrier_state_t state)
   if (state & BAR_WAS_LAST)
     {
       n = --bar->arrived;
+      bar->generation += BAR_INCR;
       if (n > 0)
 	{
 	  do
@@ -109,6 +111,51 @@ gomp_barrier_wait (gomp_barrier_t *barrier)
   gomp_barrier_wait_end (barrier, gomp_barrier_wait_start (barrier));
 }
 
+void
+gomp_barrier_wait_dock (gomp_barrier_t *bar, int *go)
+{
+  gomp_barrier_state_t state = gomp_barrier_wait_start (bar);
+  int target = (state & -BAR_INCR) + BAR_INCR;
+
+  gomp_barrier_wait_end (bar, state);
+  while (__atomic_load_n (go, MEMMODEL_ACQUIRE) != target)
+    sched_yield ();
+}
+
+/* Wait until the last thread releases the team barrier from generation
+   STATE, after having given up MUTEX1.  */
+
+static void
+gomp_team_barrier_wait_released (gomp_barrier_t *bar,
+				 gomp_barrier_state_t state)
+{
+  unsigned int n;
+  int gen;
+
+  do
+    {
+      gomp_sem_wait (&bar->sem1);
+      gen = __atomic_load_n (&bar->generation, MEMMODEL_ACQUIRE);
+      if (gen & BAR_TASK_PENDING)
+	{
+	  gomp_barrier_handle_tasks (state);
+	  gen = __atomic_load_n (&bar->generation, MEMMODEL_ACQUIRE);
+	}
+    }
+  while (gen != state + BAR_INCR);
+
+#ifdef HAVE_SYNC_BUILTINS
+  n = __sync_add_and_fetch (&bar->arrived, -1);
+#else
+  gomp_mutex_lock (&bar->mutex2);
+  n = --bar->arrived;
+  gomp_mutex_unlock (&bar->mutex2);
+#endif
+
+  if (n == 0)
+    gomp_sem_post (&bar->sem2);
+}
+
 void
 gomp_team_barrier_wait_end (gomp_barrier_t *bar, gomp_barrier_state_t state)
 {
@@ -144,30 +191,32 @@ gomp_team_barrier_wait_end (gomp_barrier_t *bar, gomp_barrier_state_t state)
   else
     {
       gomp_mutex_unlock (&bar->mutex1);
-      int gen;
-      do
-	{
-	  gomp_sem_wait (&bar->sem1);
-	  gen = __atomic_load_n (&bar->generation, MEMMODEL_ACQUIRE);
-	  if (gen & BAR_TASK_PENDING)
-	    {
-	      gomp_barrier_handle_tasks (state);
-	      gen = __atomic_load_n (&bar->generation, MEMMODEL_ACQUIRE);
-	    }
-	}
-      while (gen != state + BAR_INCR);
+      gomp_team_barrier_wait_released (bar, state);
+    }
+}
 
-#ifdef HAVE_SYNC_BUILTINS
-      n = __sync_add_and_fetch (&bar->arrived, -1);
-#else
-      gomp_mutex_lock (&bar->mutex2);
-      n = --bar->arrived;
-      gomp_mutex_unlock (&bar->mutex2);
-#endif
+/* With omp_barrier_arrive, a thread that isn't the last to arrive drops
+   MUTEX1 right away rather than in gomp_team_barrier_wait_end, so that
+   the rest of the team can arrive while it does its own work.  */
 
-      if (n == 0)
-	gomp_sem_post (&bar->sem2);
-    }
+gomp_barrier_state_t
+gomp_team_barrier_arrive (gomp_barrier_t *bar)
+{
+  gomp_barrier_state_t state = gomp_barrier_wait_start (bar);
+
+  if ((state & BAR_WAS_LAST) == 0)
+    gomp_mutex_unlock (&bar->mutex1);
+  return state;
+}
+
+void
+gomp_team_barrier_wait_arrived (gomp_barrier_t *bar,
+				gomp_barrier_state_t state)
+{
+  if (state & BAR_WAS_LAST)
+    gomp_team_barrier_wait_end (bar, state);
+  else
+    gomp_team_barrier_wait_released (bar, state & ~BAR_CANCELLED);
 }
 
 bool
@@ -251,6 +300,25 @@ gomp_team_barrier_wait (gomp_barrier_t *barrier)
   gomp_team_barrier_wait_end (barrier, gomp_barrier_wait_start (barrier));
 }
 
+/* Wait at the team barrier BAR, combining the *VALUE of all the threads
+   with COMBINE, and store the result in *VALUE of each of them.  The
+   values are combined as the threads arrive, under BAR->mutex1.  */
+
+void
+gomp_team_barrier_reduce (gomp_barrier_t *bar, gomp_barrier_value_t *value,
+			  gomp_barrier_combine_fn combine)
+{
+  gomp_barrier_state_t state = gomp_barrier_wait_start (bar);
+  gomp_barrier_value_t *result = &bar->result[(state / BAR_INCR) & 1];
+
+  if (bar->arrived == 1)
+    *result = *value;
+  else
+    combine (result, value);
+  gomp_team_barrier_wait_end (bar, state);
+  *value = *result;
+}
+
 void
 gomp_team_barrier_wake (gomp_barrier_t *bar, int count)
 {
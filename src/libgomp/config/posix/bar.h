@@ -44,6 +44,9 @@ typedef struct
   unsigned arrived;
   unsigned generation;
   bool cancellable;
+  /* The results of gomp_team_barrier_reduce, for even and odd
+     generations.  */
+  gomp_barrier_value_t result[2];
 } gomp_barrier_t;
 
 typedef unsigned int gomp_barrier_state_t;
@@ -66,10 +69,15 @@ extern void gomp_barrier_wait_end (gomp_barrier_t *, gomp_barrier_state_t);
 extern void gomp_team_barrier_wait (gomp_barrier_t *);
 extern void gomp_team_barrier_wait_end (gomp_barrier_t *,
 					gomp_barrier_state_t);
+extern gomp_barrier_state_t gomp_team_barrier_arrive (gomp_barrier_t *);
+extern void gomp_team_barrier_wait_arrived (gomp_barrier_t *,
+					    gomp_barrier_state_t);
 extern bool gomp_team_barrier_wait_cancel (gomp_barrier_t *);
 extern bool gomp_team_barrier_wait_cancel_end (gomp_barrier_t *,
 					       gomp_barrier_state_t);
 extern void gomp_team_barrier_wake (gomp_barrier_t *, int);
+extern void gomp_team_barrier_reduce (gomp_barrier_t *, gomp_barrier_value_t *,
+				      gomp_barrier_combine_fn);
 struct gomp_team;
 extern void gomp_team_barrier_cancel (struct gomp_team *);
 
@@ -97,6 +105,63 @@ gomp_barrier_wait_cancel_start (gomp_barrier_t *bar)
   return ret;
 }
 
+/* There's no combining tree here; team barriers are plain barriers.  */
+
+static inline void
+gomp_team_barrier_init (gomp_barrier_t *bar, unsigned count)
+{
+  gomp_barrier_init (bar, count);
+}
+
+static inline void
+gomp_team_barrier_init_places (gomp_barrier_t *bar, const unsigned *places)
+{
+  (void) bar;
+  (void) places;
+}
+
+/* Set up the team barrier BAR again for a team reused by gomp_new_team.
+   Its mutexes and semaphores are left as the last team left them.  */
+
+static inline void
+gomp_team_barrier_reset (gomp_barrier_t *bar)
+{
+  bar->arrived = 0;
+  bar->generation = 0;
+  bar->cancellable = false;
+}
+
+/* The dock of a thread pool, see config/linux/bar.c.  Here threads
+   wait for the barrier first and then yield until their word GO is
+   set, which only takes as long as the launch of the team.  */
+
+extern void gomp_barrier_wait_dock (gomp_barrier_t *, int *);
+
+static inline gomp_barrier_state_t
+gomp_barrier_dock_target (gomp_barrier_t *bar)
+{
+  return ((__atomic_load_n (&bar->generation, MEMMODEL_RELAXED) & -BAR_INCR)
+	  + BAR_INCR);
+}
+
+static inline void
+gomp_barrier_undock (int *go, gomp_barrier_state_t target)
+{
+  __atomic_store_n (go, target, MEMMODEL_RELEASE);
+}
+
+static inline gomp_barrier_state_t
+gomp_team_barrier_wait_start (gomp_barrier_t *bar)
+{
+  return gomp_barrier_wait_start (bar);
+}
+
+static inline gomp_barrier_state_t
+gomp_team_barrier_wait_cancel_start (gomp_barrier_t *bar)
+{
+  return gomp_barrier_wait_cancel_start (bar);
+}
+
 static inline void
 gomp_team_barrier_wait_final (gomp_barrier_t *bar)
 {
@@ -136,6 +201,16 @@ gomp_team_barrier_set_waiting_for_tasks (gomp_barrier_t *bar)
   bar->generation |= BAR_WAITING_FOR_TASK;
 }
 
+/* Unlike the other inlines, this one may be called without
+   team->task_lock held.  */
+
+static inline bool
+gomp_team_barrier_task_pending (gomp_barrier_t *bar)
+{
+  return (__atomic_load_n (&bar->generation, MEMMODEL_SEQ_CST)
+	  & BAR_TASK_PENDING) != 0;
+}
+
 static inline bool
 gomp_team_barrier_waiting_for_tasks (gomp_barrier_t *bar)
 {
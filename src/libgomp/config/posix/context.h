@@ -0,0 +1,75 @@
+/* Copyright (C) 2014 Free Software Foundation, Inc.
+
+   This file is part of the GNU OpenMP Library (libgomp).
+
+   Libgomp is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   Libgomp is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+   FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+   more details.
+
+   Under Section 7 of GPL version 3, you are granted additional
+   permissions described in the GCC Runtime Library Exception, version
+   3.1, as published by the Free Software Foundation.
+
+   You should have received a copy of the GNU General Public License and
+   a copy of the GCC Runtime Library Exception along with this program;
+   see the files COPYING3 and COPYING.RUNTIME respectively.  If not, see
+   <http://www.gnu.org/licenses/>.  */
+
+/* This is the default implementation of the user-level contexts untied
+   tasks run in, so that they can be suspended on one thread and resumed
+   on another.  This type is private to the library.  It uses the
+   <ucontext.h> functions, which can only pass int arguments to the
+   function a context starts with, hence the pointers split in two.  */
+
+#ifndef GOMP_CONTEXT_H
+#define GOMP_CONTEXT_H 1
+
+#include <stdint.h>
+#include <ucontext.h>
+
+typedef ucontext_t gomp_context_t;
+
+static void
+gomp_context_trampoline (unsigned fn_hi, unsigned fn_lo,
+			 unsigned arg_hi, unsigned arg_lo)
+{
+  void (*fn) (void *)
+    = (void (*) (void *)) (((uintptr_t) fn_hi << 16 << 16) | fn_lo);
+  void *arg = (void *) (((uintptr_t) arg_hi << 16 << 16) | arg_lo);
+
+  fn (arg);
+}
+
+/* Set up CTX to run FN (ARG) on the SIZE bytes of STACK the first time
+   it is switched to.  FN must never return.  */
+
+static inline void
+gomp_context_init (gomp_context_t *ctx, void *stack, size_t size,
+		   void (*fn) (void *), void *arg)
+{
+  uintptr_t f = (uintptr_t) fn, a = (uintptr_t) arg;
+
+  getcontext (ctx);
+  ctx->uc_stack.ss_sp = stack;
+  ctx->uc_stack.ss_size = size;
+  ctx->uc_link = NULL;
+  makecontext (ctx, (void (*) (void)) gomp_context_trampoline, 4,
+	       (unsigned) (f >> 16 >> 16), (unsigned) f,
+	       (unsigned) (a >> 16 >> 16), (unsigned) a);
+}
+
+/* Save the current context in FROM and continue with TO.  */
+
+static inline void
+gomp_context_switch (gomp_context_t *from, gomp_context_t *to)
+{
+  swapcontext (from, to);
+}
+
+#endif /* GOMP_CONTEXT_H */
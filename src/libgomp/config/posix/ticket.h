@@ -0,0 +1,50 @@
+/* Copyright (C) 2014 Free Software Foundation, Inc.
+
+   This file is part of the GNU OpenMP Library (libgomp).
+
+   Libgomp is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   Libgomp is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+   FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+   more details.
+
+   Under Section 7 of GPL version 3, you are granted additional
+   permissions described in the GCC Runtime Library Exception, version
+   3.1, as published by the Free Software Foundation.
+
+   You should have received a copy of the GNU General Public License and
+   a copy of the GCC Runtime Library Exception along with this program;
+   see the files COPYING3 and COPYING.RUNTIME respectively.  If not, see
+   <http://www.gnu.org/licenses/>.  */
+
+
+/* This is the default implementation of the ticket hand-off used by
+   ORDERED sections and the work share ring.  This type is private to
+   the library.  Without a futex-like primitive waiters simply spin,
+   yielding the processor between polls of the "now serving" counter.  */
+
+#ifndef GOMP_TICKET_H
+#define GOMP_TICKET_H 1
+
+#include <sched.h>
+
+static inline void
+gomp_ticket_wait (unsigned *serving, int *sleepers, unsigned ticket)
+{
+  (void) sleepers;
+  while ((int) (__atomic_load_n (serving, MEMMODEL_ACQUIRE) - ticket) < 0)
+    sched_yield ();
+}
+
+static inline void
+gomp_ticket_serve (unsigned *serving, int *sleepers, unsigned ticket)
+{
+  (void) sleepers;
+  __atomic_store_n (serving, ticket, MEMMODEL_RELEASE);
+}
+
+#endif /* GOMP_TICKET_H */
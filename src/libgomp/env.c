@@ -66,12 +66,20 @@ struct gomp_task_icv gomp_global_icv = {
 
 unsigned long gomp_max_active_levels_var = INT_MAX;
 bool gomp_cancel_var = false;
+int gomp_max_task_priority_var = 0;
 bool gomp_binlpt_debug_var = false;
+unsigned long gomp_iter_pools_var = 1;
+bool gomp_ordered_tickets_var = false;
+enum gomp_barrier_kind gomp_barrier_var = GOMP_BARRIER_CENTRAL;
+unsigned long gomp_task_cutoff_min_var = 4;
+unsigned long gomp_task_cutoff_max_var = GOMP_TASK_DEQUE_SIZE;
+unsigned long gomp_untied_stacksize_var = 0;
 #ifndef HAVE_SYNC_BUILTINS
 gomp_mutex_t gomp_managed_threads_lock;
 #endif
 unsigned long gomp_available_cpus = 1, gomp_managed_threads = 1;
 unsigned long long gomp_spin_count_var, gomp_throttled_spin_count_var;
+bool gomp_spin_adaptive_var = true;
 unsigned long *gomp_nthreads_var_list, gomp_nthreads_var_list_len;
 char *gomp_bind_var_list;
 unsigned long gomp_bind_var_list_len;
@@ -887,6 +895,48 @@ parse_boolean (const char *name, bool *value)
     gomp_error ("Invalid value for environment variable %s", name);
 }
 
+/* Parse the GOMP_BARRIER environment variable and store the result in
+   gomp_barrier_var.  */
+
+static void
+parse_barrier (void)
+{
+  const char *env;
+  enum gomp_barrier_kind kind = GOMP_BARRIER_CENTRAL;
+
+  env = getenv ("GOMP_BARRIER");
+  if (env == NULL)
+    return;
+
+  while (isspace ((unsigned char) *env))
+    ++env;
+  if (strncasecmp (env, "central", 7) == 0)
+    {
+      kind = GOMP_BARRIER_CENTRAL;
+      env += 7;
+    }
+  else if (strncasecmp (env, "tree", 4) == 0)
+    {
+      kind = GOMP_BARRIER_TREE;
+      env += 4;
+    }
+  else if (strncasecmp (env, "topology", 8) == 0)
+    {
+      kind = GOMP_BARRIER_TOPOLOGY;
+      env += 8;
+    }
+  else
+    env = "X";
+  while (isspace ((unsigned char) *env))
+    ++env;
+  if (*env == '\0')
+    {
+      gomp_barrier_var = kind;
+      return;
+    }
+  gomp_error ("Invalid value for environment variable GOMP_BARRIER");
+}
+
 /* Parse the OMP_WAIT_POLICY environment variable and store the
    result in gomp_active_wait_policy.  */
 
@@ -1159,11 +1209,25 @@ handle_omp_display_env (unsigned long stacksize, int wait_policy)
 	   gomp_cancel_var ? "TRUE" : "FALSE");
   fprintf (stderr, "  OMP_DEFAULT_DEVICE = '%d'\n",
 	   gomp_global_icv.default_device_var);
+  fprintf (stderr, "  OMP_MAX_TASK_PRIORITY = '%d'\n",
+	   gomp_max_task_priority_var);
 
   if (verbose)
     {
       fputs ("  GOMP_CPU_AFFINITY = ''\n", stderr);
       fprintf (stderr, "  GOMP_STACKSIZE = '%lu'\n", stacksize);
+      fprintf (stderr, "  GOMP_ITER_POOLS = '%lu'\n", gomp_iter_pools_var);
+      fprintf (stderr, "  GOMP_ORDERED_TICKETS = '%s'\n",
+	       gomp_ordered_tickets_var ? "TRUE" : "FALSE");
+      fprintf (stderr, "  GOMP_BARRIER = '%s'\n",
+	       gomp_barrier_var == GOMP_BARRIER_TOPOLOGY ? "TOPOLOGY"
+	       : gomp_barrier_var == GOMP_BARRIER_TREE ? "TREE" : "CENTRAL");
+      fprintf (stderr, "  GOMP_TASK_CUTOFF_MIN = '%lu'\n",
+	       gomp_task_cutoff_min_var);
+      fprintf (stderr, "  GOMP_TASK_CUTOFF_MAX = '%lu'\n",
+	       gomp_task_cutoff_max_var);
+      fprintf (stderr, "  GOMP_UNTIED_STACKSIZE = '%lu'\n",
+	       gomp_untied_stacksize_var);
 #ifdef HAVE_INTTYPES_H
       fprintf (stderr, "  GOMP_SPINCOUNT = '%"PRIu64"'\n",
 	       (uint64_t) gomp_spin_count_var);
@@ -1171,6 +1235,8 @@ handle_omp_display_env (unsigned long stacksize, int wait_policy)
       fprintf (stderr, "  GOMP_SPINCOUNT = '%lu'\n",
 	       (unsigned long) gomp_spin_count_var);
 #endif
+      fprintf (stderr, "  GOMP_SPIN_ADAPTIVE = '%s'\n",
+	       gomp_spin_adaptive_var ? "TRUE" : "FALSE");
     }
 
   fputs ("OPENMP DISPLAY ENVIRONMENT END\n", stderr);
@@ -1191,7 +1257,10 @@ initialize_env (void)
   parse_boolean ("OMP_NESTED", &gomp_global_icv.nest_var);
   parse_boolean ("OMP_CANCELLATION", &gomp_cancel_var);
   parse_boolean ("OMP_BINLPT_DEBUG", &gomp_binlpt_debug_var);
+  parse_boolean ("GOMP_ORDERED_TICKETS", &gomp_ordered_tickets_var);
+  parse_barrier ();
   parse_int ("OMP_DEFAULT_DEVICE", &gomp_global_icv.default_device_var, true);
+  parse_int ("OMP_MAX_TASK_PRIORITY", &gomp_max_task_priority_var, true);
   parse_unsigned_long ("OMP_MAX_ACTIVE_LEVELS", &gomp_max_active_levels_var,
 		       true);
   if (parse_unsigned_long ("OMP_THREAD_LIMIT", &thread_limit_var, false))
@@ -1238,6 +1307,27 @@ initialize_env (void)
     }
   if (gomp_global_icv.bind_var != omp_proc_bind_false)
     gomp_init_affinity ();
+  /* GOMP_ITER_POOLS=0 asks for one iteration pool per socket spanned by
+     the places list.  */
+  if (parse_unsigned_long ("GOMP_ITER_POOLS", &gomp_iter_pools_var, true)
+      && gomp_iter_pools_var == 0)
+    gomp_iter_pools_var = gomp_num_sockets;
+  if (gomp_iter_pools_var > GOMP_MAX_ITER_POOLS)
+    gomp_iter_pools_var = GOMP_MAX_ITER_POOLS;
+
+  /* Setting both bounds to the same value, e.g. 64, gives back a fixed
+     cutoff of that many tasks per thread.  */
+  parse_unsigned_long ("GOMP_TASK_CUTOFF_MAX", &gomp_task_cutoff_max_var,
+		       false);
+  if (gomp_task_cutoff_max_var > UINT_MAX / 2)
+    gomp_task_cutoff_max_var = UINT_MAX / 2;
+  parse_unsigned_long ("GOMP_TASK_CUTOFF_MIN", &gomp_task_cutoff_min_var,
+		       false);
+  if (gomp_task_cutoff_min_var > gomp_task_cutoff_max_var)
+    gomp_task_cutoff_min_var = gomp_task_cutoff_max_var;
+  /* Untied tasks only get a stack of their own, and so can move to
+     another thread at taskyield, if this is set.  */
+  parse_stacksize ("GOMP_UNTIED_STACKSIZE", &gomp_untied_stacksize_var);
   wait_policy = parse_wait_policy ();
   if (!parse_spincount ("GOMP_SPINCOUNT", &gomp_spin_count_var))
     {
@@ -1260,6 +1350,11 @@ initialize_env (void)
     gomp_throttled_spin_count_var = 100LL;
   if (gomp_throttled_spin_count_var > gomp_spin_count_var)
     gomp_throttled_spin_count_var = gomp_spin_count_var;
+  /* With OMP_WAIT_POLICY=active, spin for the whole GOMP_SPINCOUNT
+     unless adaptive spinning is asked for explicitly.  */
+  if (wait_policy > 0)
+    gomp_spin_adaptive_var = false;
+  parse_boolean ("GOMP_SPIN_ADAPTIVE", &gomp_spin_adaptive_var);
 
   /* Not strictly environment related, but ordering constructors is tricky.  */
   pthread_attr_init (&gomp_thread_attr);
@@ -1445,6 +1540,12 @@ omp_is_initial_device (void)
   return 1;
 }
 
+int
+omp_get_max_task_priority (void)
+{
+  return gomp_max_task_priority_var;
+}
+
 ialias (omp_set_dynamic)
 ialias (omp_set_nested)
 ialias (omp_set_num_threads)
@@ -1464,3 +1565,4 @@ ialias (omp_get_num_devices)
 ialias (omp_get_num_teams)
 ialias (omp_get_team_num)
 ialias (omp_is_initial_device)
+ialias (omp_get_max_task_priority)
@@ -99,6 +99,7 @@ gomp_iter_static_next (long *pstart, long *pend)
 
       *pstart = s;
       *pend = e;
+      thr->ts.ordered_ticket = i;
       thr->ts.static_trip = (e0 == n ? -1 : 1);
       return 0;
     }
@@ -132,6 +133,7 @@ gomp_iter_static_next (long *pstart, long *pend)
 
       *pstart = s;
       *pend = e;
+      thr->ts.ordered_ticket = s0 / c;
 
       if (e0 == n)
 	thr->ts.static_trip = -1;
@@ -179,6 +181,121 @@ gomp_iter_dynamic_next_locked (long *pstart, long *pend)
 
 
 #ifdef HAVE_SYNC_BUILTINS
+/* Split the iteration space of a DYNAMIC or GUIDED loop into per-socket
+   pools, as requested by GOMP_ITER_POOLS.  Pool boundaries fall on chunk
+   boundaries, so every chunk but the last one of the loop still has the
+   requested size.  NTHREADS is the size of the team that will execute
+   the loop.  */
+
+void
+gomp_iter_init_pools (struct gomp_work_share *ws, unsigned nthreads)
+{
+  unsigned long n, c, nchunks, lo, hi;
+  unsigned npools, i;
+  long s;
+
+  ws->npools = 1;
+  if (__builtin_expect (gomp_iter_pools_var <= 1, 1)
+      || nthreads <= 1 || ws->next == ws->end)
+    return;
+
+  s = ws->incr + (ws->incr > 0 ? -1 : 1);
+  n = (ws->end - ws->next + s) / ws->incr;
+  if (ws->sched == GFS_DYNAMIC)
+    c = ws->chunk_size / ws->incr;
+  else
+    c = ws->chunk_size;
+  if (c == 0)
+    c = 1;
+  nchunks = n / c + (n % c != 0);
+
+  npools = gomp_iter_pools_var;
+  if (npools > nthreads)
+    npools = nthreads;
+  if (npools > nchunks)
+    npools = nchunks;
+  if (npools <= 1)
+    return;
+
+  /* GOMP_ITER_POOLS doesn't change, so pools allocated for an earlier
+     loop in this work share are large enough.  */
+  if (__builtin_expect (ws->pools == NULL, 0))
+    ws->pools = gomp_aligned_alloc (64, gomp_iter_pools_var
+					* sizeof (struct gomp_iter_pool));
+  for (i = 0; i < npools; i++)
+    {
+      lo = i * nchunks / npools * c;
+      hi = (i + 1) * nchunks / npools * c;
+      if (hi > n)
+	hi = n;
+      ws->pools[i].next = ws->next + (long) lo * ws->incr;
+      ws->pools[i].end = ws->next + (long) hi * ws->incr;
+    }
+  ws->npools = npools;
+}
+
+/* Return the pool the calling thread should allocate iterations from
+   first.  Threads bound to a place use the socket of that place,
+   otherwise the team is split into contiguous blocks of thread ids.  */
+
+static inline unsigned
+gomp_iter_pool_index (struct gomp_thread *thr, struct gomp_work_share *ws)
+{
+  unsigned nthreads = thr->ts.team ? thr->ts.team->nthreads : 1;
+
+  if (gomp_places_socket != NULL && thr->place != 0)
+    return gomp_places_socket[thr->place - 1] % ws->npools;
+  return thr->ts.team_id * ws->npools / nthreads;
+}
+
+/* Allocate a chunk of a DYNAMIC loop from the pools of WS, starting at the
+   calling thread's local pool and moving on to remote pools only once the
+   local one is exhausted.  */
+
+static bool
+gomp_iter_pool_dynamic_next (struct gomp_thread *thr,
+			     struct gomp_work_share *ws,
+			     long *pstart, long *pend)
+{
+  unsigned i, p = gomp_iter_pool_index (thr, ws);
+  long incr = ws->incr;
+
+  for (i = 0; i < ws->npools; i++, p = (p + 1 == ws->npools ? 0 : p + 1))
+    {
+      struct gomp_iter_pool *pool = &ws->pools[p];
+      long start = __atomic_load_n (&pool->next, MEMMODEL_RELAXED);
+      long end = pool->end;
+
+      while (start != end)
+	{
+	  long chunk = ws->chunk_size, left = end - start, nend, tmp;
+
+	  if (incr < 0)
+	    {
+	      if (chunk < left)
+		chunk = left;
+	    }
+	  else
+	    {
+	      if (chunk > left)
+		chunk = left;
+	    }
+	  nend = start + chunk;
+
+	  tmp = __sync_val_compare_and_swap (&pool->next, start, nend);
+	  if (__builtin_expect (tmp == start, 1))
+	    {
+	      *pstart = start;
+	      *pend = nend;
+	      return true;
+	    }
+	  start = tmp;
+	}
+    }
+
+  return false;
+}
+
 /* Similar, but doesn't require the lock held, and uses compare-and-swap
    instead.  Note that the only memory value that changes is ws->next.  */
 
@@ -189,6 +306,9 @@ gomp_iter_dynamic_next (long *pstart, long *pend)
   struct gomp_work_share *ws = thr->ts.work_share;
   long start, end, nend, chunk, incr;
 
+  if (__builtin_expect (ws->npools > 1, 0))
+    return gomp_iter_pool_dynamic_next (thr, ws, pstart, pend);
+
   end = ws->end;
   incr = ws->incr;
   chunk = ws->chunk_size;
@@ -269,13 +389,14 @@ gomp_iter_binlpt_next (long *pstart, long *pend)
   ws = thr->ts.work_share;
   tid = omp_get_thread_num();
   /* Search for next task. */
-  start = ws->thread_start[tid];
+  start = thr->ts.taskmap_cursor;
   for (i = start; i < __ntasks; i++)
   {
      if (ws->taskmap[i] == tid)
        goto found;
   }
 
+  thr->ts.taskmap_cursor = __ntasks;
   return (false);
 
 found:
@@ -286,7 +407,7 @@ found:
        break;
   }
 
-	ws->thread_start[tid] = j;
+	thr->ts.taskmap_cursor = j;
 	*pstart = ws->loop_start + i;
 	*pend = ws->loop_start + j;
 
@@ -307,18 +428,19 @@ gomp_iter_srr_next (long *pstart, long *pend)
   tid = omp_get_thread_num();
 
   /* Search for next task. */
-  start = ws->thread_start[tid];
+  start = thr->ts.taskmap_cursor;
   for (i = start; i < __ntasks; i++)
   {
      if (ws->taskmap[i] == tid)
        goto found;
   }
 
+  thr->ts.taskmap_cursor = __ntasks;
   return (false);
 
 found:
 
-	ws->thread_start[tid] = i + 1;
+	thr->ts.taskmap_cursor = i + 1;
 	*pstart = ws->loop_start + i;
 	*pend = ws->loop_start + i + 1;
 
@@ -365,6 +487,55 @@ gomp_iter_guided_next_locked (long *pstart, long *pend)
 /* Similar, but doesn't require the lock held, and uses compare-and-swap
    instead.  Note that the only memory value that changes is ws->next.  */
 
+/* Allocate a chunk of a GUIDED loop from the pools of WS.  Chunk sizes
+   are computed from what is left in the pool and the number of threads
+   sharing it, so each socket runs its own guided schedule.  */
+
+static bool
+gomp_iter_pool_guided_next (struct gomp_thread *thr,
+			    struct gomp_work_share *ws,
+			    long *pstart, long *pend)
+{
+  unsigned long nthreads = thr->ts.team ? thr->ts.team->nthreads : 1;
+  unsigned i, p = gomp_iter_pool_index (thr, ws);
+  long incr = ws->incr;
+
+  nthreads = (nthreads + ws->npools - 1) / ws->npools;
+  for (i = 0; i < ws->npools; i++, p = (p + 1 == ws->npools ? 0 : p + 1))
+    {
+      struct gomp_iter_pool *pool = &ws->pools[p];
+      long start = __atomic_load_n (&pool->next, MEMMODEL_RELAXED);
+      long end = pool->end;
+
+      while (start != end)
+	{
+	  unsigned long n, q;
+	  long nend, tmp;
+
+	  n = (end - start) / incr;
+	  q = (n + nthreads - 1) / nthreads;
+
+	  if (q < ws->chunk_size)
+	    q = ws->chunk_size;
+	  if (__builtin_expect (q <= n, 1))
+	    nend = start + q * incr;
+	  else
+	    nend = end;
+
+	  tmp = __sync_val_compare_and_swap (&pool->next, start, nend);
+	  if (__builtin_expect (tmp == start, 1))
+	    {
+	      *pstart = start;
+	      *pend = nend;
+	      return true;
+	    }
+	  start = tmp;
+	}
+    }
+
+  return false;
+}
+
 bool
 gomp_iter_guided_next (long *pstart, long *pend)
 {
@@ -375,6 +546,9 @@ gomp_iter_guided_next (long *pstart, long *pend)
   long start, end, nend, incr;
   unsigned long chunk_size;
 
+  if (__builtin_expect (ws->npools > 1, 0))
+    return gomp_iter_pool_guided_next (thr, ws, pstart, pend);
+
   start = ws->next;
   end = ws->end;
   incr = ws->incr;
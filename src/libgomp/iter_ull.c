@@ -97,6 +97,7 @@ gomp_iter_ull_static_next (gomp_ull *pstart, gomp_ull *pend)
 
       *pstart = s;
       *pend = e;
+      thr->ts.ordered_ticket = i;
       thr->ts.static_trip = (e0 == n ? -1 : 1);
       return 0;
     }
@@ -131,6 +132,7 @@ gomp_iter_ull_static_next (gomp_ull *pstart, gomp_ull *pend)
 
       *pstart = s;
       *pend = e;
+      thr->ts.ordered_ticket = s0 / c;
 
       if (e0 == n)
 	thr->ts.static_trip = -1;
@@ -68,6 +68,19 @@ union tick_t
 
 union tick_t t0, t1;
 
+/* A value reduced by gomp_team_barrier_reduce, and the function that
+   combines the second value given to it into the first.  */
+typedef union
+{
+  int i;
+  long l;
+  float f;
+  double d;
+} gomp_barrier_value_t;
+
+typedef void (*gomp_barrier_combine_fn) (gomp_barrier_value_t *,
+					 const gomp_barrier_value_t *);
+
 #include "sem.h"
 #include "mutex.h"
 #include "bar.h"
@@ -88,6 +101,28 @@ enum gomp_schedule_type
   GFS_AUTO
 };
 
+/* Upper bound on the number of per-socket pools the iteration space of a
+   dynamic or guided loop is split into.  */
+#define GOMP_MAX_ITER_POOLS 8
+
+/* Number of slots of the work share ring embedded in a team, and the
+   most a team can get allocated if nowait constructs need more.  */
+#define GOMP_WORK_SHARE_RING 8
+#define GOMP_WORK_SHARE_RING_MAX 256
+
+/* One pool of iterations of a hierarchically scheduled loop.  Each pool
+   lives in its own cache line, so that threads of one socket only bounce
+   that line among themselves.  */
+
+struct gomp_iter_pool
+{
+  /* This is the next iteration value to be allocated from this pool.  */
+  long next;
+
+  /* This is the iteration end point of this pool.  */
+  long end;
+} __attribute__((aligned (64)));
+
 struct gomp_work_share
 {
   /* This member records the SCHEDULE clause to be used for this construct.
@@ -141,10 +176,6 @@ struct gomp_work_share
      current thread that's allowed into the ordered reason.  */
   unsigned ordered_cur;
 
-  /* This is a chain of allocated gomp_work_share blocks, valid only
-     in the first gomp_work_share struct in the block.  */
-  struct gomp_work_share *next_alloc;
-
   /* The above fields are written once during workshare initialization,
      or related to ordered worksharing.  Make sure the following fields
      are in a different cache line.  */
@@ -158,6 +189,10 @@ struct gomp_work_share
      of the team to exit the work share construct must deallocate it.  */
   unsigned threads_completed;
 
+  /* With GOMP_ORDERED_TICKETS, this is the ticket handed out with the next
+     iteration block of a DYNAMIC or GUIDED ordered loop.  */
+  unsigned ordered_next_ticket;
+
   union {
     /* This is the next iteration value to be allocated.  In the case of
        GFS_STATIC loops, this the iteration start point and never changes.  */
@@ -175,17 +210,38 @@ struct gomp_work_share
    */
   long loop_start;
   unsigned *taskmap;
-  unsigned *thread_start;
-
-  union {
-    /* Link to gomp_work_share struct for next work sharing construct
-       encountered after this one.  */
-    gomp_ptrlock_t next_ws;
-
-    /* gomp_work_share structs are chained in the free work share cache
-       through this.  */
-    struct gomp_work_share *next_free;
-  };
+  /* The task map this construct replaced in the loop cache.  Threads may
+     still read it in earlier nowait constructs, so it is only freed with
+     this work share, once all threads are past them.  */
+  unsigned *taskmap_free;
+
+  /* Number of iteration pools used by GFS_DYNAMIC and GFS_GUIDED loops, or
+     1 if all threads allocate directly from the NEXT member.  */
+  unsigned npools;
+
+  /* Per-socket iteration pools, valid only if NPOOLS is greater than 1.
+     Allocated the first time a loop in this work share needs them and
+     kept for later constructs, see gomp_init_work_share_pools.  */
+  struct gomp_iter_pool *pools;
+
+  /* With GOMP_ORDERED_TICKETS, this is the ticket of the iteration block
+     currently allowed into the ordered section.  It is bumped by its
+     owner without taking LOCK, and sits in its own cache line so that
+     spinning waiters don't slow down iteration allocation.  */
+  unsigned ordered_serving __attribute__((aligned (64)));
+
+  /* Number of threads blocked in the kernel on ORDERED_SERVING.  */
+  int ordered_sleepers;
+
+  /* The state of this work share as a slot of the team's ring, see
+     gomp_work_share_start.  RING_SERVING is twice the number of the
+     construct the slot is free for, plus one once the first thread to
+     reach that construct has initialized it.  RING_ARRIVED counts the
+     threads that reached it.  gomp_init_work_share leaves these alone,
+     as other threads may already wait on RING_SERVING.  */
+  unsigned ring_serving __attribute__((aligned (64)));
+  int ring_sleepers;
+  unsigned ring_arrived;
 
   /* If only few threads are in the team, ordered_team_ids can point
      to this array which fills the padding at the end of this struct.  */
@@ -206,11 +262,10 @@ struct gomp_team_state
      processing the same construct.  */
   struct gomp_work_share *work_share;
 
-  /* This is the previous work share construct or NULL if there wasn't any.
-     When all threads are done with the current work sharing construct,
-     the previous one can be freed.  The current one can't, as its
-     next_ws field is used.  */
-  struct gomp_work_share *last_work_share;
+  /* This is the number of the work sharing construct this thread is
+     processing, 0 for the initial work share of the team.  Construct N
+     uses the slot (N - 1) % work_share_chunk of the team's ring.  */
+  unsigned work_share_seq;
 
   /* This is the ID of this thread within the team.  This value is
      guaranteed to be between 0 and N-1, where N is the number of
@@ -238,6 +293,16 @@ struct gomp_team_state
      is 1, etc.  This is unused when the compiler knows in advance that
      the loop is statically scheduled.  */
   unsigned long static_trip;
+
+  /* For GFS_BINLPT and GFS_SRR loops, this is the index of the taskmap
+     entry from which this thread resumes searching for its next chunk.
+     Kept per thread, so that loop entry doesn't allocate a cursor array
+     and threads don't false-share their cursors.  */
+  unsigned long taskmap_cursor;
+
+  /* With GOMP_ORDERED_TICKETS, this is the ticket of the iteration block
+     this thread is executing in an ordered loop.  */
+  unsigned ordered_ticket;
 };
 
 struct target_mem_desc;
@@ -261,20 +326,45 @@ struct gomp_task_icv
   struct target_mem_desc *target_data;
 };
 
+/* How the threads of a team arrive at the team barrier, as selected by
+   GOMP_BARRIER.  */
+
+enum gomp_barrier_kind
+{
+  /* All threads decrement one counter.  */
+  GOMP_BARRIER_CENTRAL,
+  /* Threads arrive through a combining tree.  */
+  GOMP_BARRIER_TREE,
+  /* The same, with the tree following the cores, caches and sockets of
+     the places the threads are bound to.  */
+  GOMP_BARRIER_TOPOLOGY
+};
+
 extern struct gomp_task_icv gomp_global_icv;
 #ifndef HAVE_SYNC_BUILTINS
 extern gomp_mutex_t gomp_managed_threads_lock;
 #endif
 extern unsigned long gomp_max_active_levels_var;
 extern bool gomp_cancel_var;
+extern int gomp_max_task_priority_var;
 extern bool gomp_binlpt_debug_var;
+extern unsigned long gomp_iter_pools_var;
+extern bool gomp_ordered_tickets_var;
+extern enum gomp_barrier_kind gomp_barrier_var;
+extern unsigned long gomp_task_cutoff_min_var, gomp_task_cutoff_max_var;
+extern unsigned long gomp_untied_stacksize_var;
 extern unsigned long long gomp_spin_count_var, gomp_throttled_spin_count_var;
+extern bool gomp_spin_adaptive_var;
 extern unsigned long gomp_available_cpus, gomp_managed_threads;
 extern unsigned long *gomp_nthreads_var_list, gomp_nthreads_var_list_len;
 extern char *gomp_bind_var_list;
 extern unsigned long gomp_bind_var_list_len;
 extern void **gomp_places_list;
 extern unsigned long gomp_places_list_len;
+extern unsigned short *gomp_places_socket;
+extern unsigned short *gomp_places_cache;
+extern unsigned short *gomp_places_core;
+extern unsigned long gomp_num_sockets;
 
 enum gomp_task_kind
 {
@@ -286,6 +376,9 @@ enum gomp_task_kind
 
 struct gomp_task;
 struct gomp_taskgroup;
+struct gomp_taskgraph;
+struct gomp_taskgraph_node;
+struct gomp_task_context;
 struct htab;
 
 struct gomp_task_depend_entry
@@ -302,48 +395,199 @@ struct gomp_dependers_vec
 {
   size_t n_elem;
   size_t allocated;
+  /* The waiting tasks, with GOMP_DEPENDER_WRITER or'ed in if this task
+     writes data they use.  */
   struct gomp_task *elem[];
 };
 
+#define GOMP_DEPENDER_WRITER	((uintptr_t) 1)
+
+/* Number of shards of the table of the dependencies of a task's
+   children.  Must be a power of two.  */
+#define GOMP_DEPEND_SHARDS 16
+
+/* One shard of the table mapping the addresses in depend clauses of the
+   children of a task to the children that named them and haven't
+   completed yet.  Each address belongs to one shard, picked by its hash,
+   so tasks with many depend clauses only contend for the shards of their
+   own addresses.  */
+struct gomp_depend_shard
+{
+  gomp_mutex_t lock;
+  struct htab *hash;
+} __attribute__((aligned (64)));
+
 /* This structure describes a "task" to be run by a thread.  */
 
 struct gomp_task
 {
   struct gomp_task *parent;
-  struct gomp_task *children;
-  struct gomp_task *next_child;
-  struct gomp_task *prev_child;
+  /* Links in the team's overflow or priority queues, see struct
+     gomp_team.  */
   struct gomp_task *next_queue;
   struct gomp_task *prev_queue;
-  struct gomp_task *next_taskgroup;
-  struct gomp_task *prev_taskgroup;
   struct gomp_taskgroup *taskgroup;
+  /* The tasks waiting for this one to complete, protected by
+     DEPEND_LOCK.  */
   struct gomp_dependers_vec *dependers;
-  struct htab *depend_hash;
+  /* Allocated when the first child with depend clauses is deferred.  */
+  struct gomp_depend_shard *depend_shards;
   size_t depend_count;
+  /* Number of tasks this one waits for, decremented atomically by each
+     of them as it completes.  */
   size_t num_dependees;
+  /* One more than the team_id of the thread that completed the last
+     task that wrote to an address in the depend clauses of this task,
+     or zero.  */
+  unsigned home;
+  /* The task graph being recorded or replayed by the children of this
+     task, see omp_taskgraph_begin.  */
+  struct gomp_taskgraph *taskgraph;
+  /* If this task was created by replaying a task graph, its node there,
+     which tracks its dependencies instead of DEPEND.  */
+  struct gomp_taskgraph_node *taskgraph_node;
+  /* The context of an untied task with a stack of its own, once it has
+     started running.  */
+  struct gomp_task_context *context;
   struct gomp_task_icv icv;
   void (*fn) (void *);
   void *fn_data;
+  /* One reference for the task itself until it completes, plus one for
+     each child task that hasn't completed yet, possibly or'ed with
+     GOMP_TASK_REF_WAITING.  A deferred task is freed when this drops to
+     zero, so children can always safely refer to their parent.  */
+  unsigned int refcount;
+  /* Priority of the task, from the priority clause, at most
+     gomp_max_task_priority_var.  */
+  int priority;
   enum gomp_task_kind kind;
-  bool in_taskwait;
   bool in_tied_task;
   bool final_task;
   bool copy_ctors_done;
+  /* Set for untied tasks if GOMP_UNTIED_STACKSIZE is.  */
+  bool untied;
+  /* Set under DEPEND_LOCK once the task has completed; later tasks don't
+     need to wait for it.  */
+  bool depend_done;
+  gomp_mutex_t depend_lock;
   gomp_sem_t taskwait_sem;
   struct gomp_task_depend_entry depend[];
 };
 
+/* Set in gomp_task.refcount while the task sleeps on its taskwait_sem,
+   waiting for its children.  Whoever clears it must post the semaphore.  */
+#define GOMP_TASK_REF_WAITING	(1U << 31)
+
+/* Bits of the FLAGS argument of GOMP_task.  */
+#define GOMP_TASK_FLAG_UNTIED		(1 << 0)
+#define GOMP_TASK_FLAG_FINAL		(1 << 1)
+#define GOMP_TASK_FLAG_DEPEND		(1 << 3)
+#define GOMP_TASK_FLAG_PRIORITY		(1 << 4)
+
+/* Bits of the FLAGS argument of GOMP_taskloop, on top of those of
+   GOMP_task.  */
+#define GOMP_TASK_FLAG_UP		(1 << 8)
+#define GOMP_TASK_FLAG_GRAINSIZE	(1 << 9)
+#define GOMP_TASK_FLAG_IF		(1 << 10)
+#define GOMP_TASK_FLAG_NOGROUP		(1 << 11)
+
 struct gomp_taskgroup
 {
   struct gomp_taskgroup *prev;
-  struct gomp_task *children;
   bool in_taskgroup_wait;
   bool cancelled;
   gomp_sem_t taskgroup_sem;
   size_t num_children;
 };
 
+/* A task of a task graph, see omp_taskgraph_begin.  */
+
+struct gomp_taskgraph_node
+{
+  struct gomp_taskgraph *graph;
+  void (*fn) (void *);
+  /* The addresses in the depend clauses, the first NOUT of them out or
+     inout.  */
+  void **depend;
+  size_t ndepend;
+  size_t nout;
+  /* The nodes that depend on this one are
+     graph->succs[FIRST_SUCC .. FIRST_SUCC + NSUCCS - 1].  */
+  unsigned first_succ;
+  unsigned nsuccs;
+  unsigned npreds;
+  /* While replaying, the number of predecessors yet to complete, plus one
+     until TASK has been created.  */
+  unsigned pending;
+  struct gomp_task *task;
+};
+
+/* The tasks a task creates between omp_taskgraph_begin and
+   omp_taskgraph_end, with the dependencies among them.  */
+
+struct gomp_taskgraph
+{
+  /* In order of creation, so nodes only depend on earlier ones.  */
+  struct gomp_taskgraph_node *nodes;
+  unsigned nnodes;
+  unsigned allocated;
+  unsigned *succs;
+  /* While replaying, the index of the node of the next task created.  */
+  unsigned next;
+  /* Set once the graph has been recorded completely, after which it is
+     replayed.  */
+  bool recorded;
+  /* Set between omp_taskgraph_begin and omp_taskgraph_end, or until the
+     graph is dropped, under gomp_taskgraph_lock.  */
+  bool active;
+};
+
+/* Number of priority queues of a team.  Tasks of priority
+   GOMP_TASK_PRIO_BUCKETS - 1 and above share the last one.  */
+#define GOMP_TASK_PRIO_BUCKETS 64
+
+/* Number of tasks each per-thread deque can hold.  Must be a power of two.
+   Tasks pushed onto a full deque go to the team's overflow queue.  */
+#define GOMP_TASK_DEQUE_SIZE 256
+
+/* A Chase-Lev work-stealing deque of tasks that are ready to run.  Only
+   the owning thread pushes and pops at BOTTOM, in LIFO order; the other
+   threads of the team steal the oldest task at TOP.  */
+
+struct gomp_task_deque
+{
+  /* Index of the oldest task in the deque.  */
+  long top;
+  /* Number of tasks thieves took from this deque.  */
+  unsigned long stolen;
+  /* Ready tasks other threads released to this one, because it completed
+     the last task that wrote their data, see gomp_task_enqueue.  The
+     owner takes them first, thieves after the deque.  Protected by
+     INBOX_LOCK.  */
+  struct gomp_task *inbox;
+  gomp_mutex_t inbox_lock;
+  /* Set while the owner sleeps in a team barrier with nothing to do, so
+     that whoever queues a task can wake it alone.  Whoever clears it must
+     wake the owner.  */
+  int idle;
+
+  /* Index one past the newest task in the deque, kept apart from TOP so
+     that the owner doesn't share a cache line with thieves.  */
+  long bottom __attribute__((aligned (64)));
+
+  /* Circular array of GOMP_TASK_DEQUE_SIZE tasks, allocated by the owner
+     when it first pushes.  */
+  struct gomp_task **tasks;
+
+  /* Statistics of the owner for the adaptive task cutoff: the number of
+     tasks it created and ran, STOLEN as of the last adjustment of the
+     cutoff, and a moving average of the run time of its tasks.  */
+  unsigned long created;
+  unsigned long runs;
+  unsigned long last_stolen;
+  unsigned long avg_run_ns;
+} __attribute__((aligned (64)));
+
 /* This structure describes a "team" of threads.  These are the threads
    that are spawned by a PARALLEL constructs, as well as the work sharing
    constructs that the team encounters.  */
@@ -353,10 +597,13 @@ struct gomp_team
   /* This is the number of threads in the current team.  */
   unsigned nthreads;
 
-  /* This is number of gomp_work_share structs that have been allocated
-     as a block last time.  */
+  /* This is the number of slots of WORK_SHARE_RING, a power of two.  */
   unsigned work_share_chunk;
 
+  /* The number of slots the ring should have had, because a thread got
+     that far ahead of the others through nowait constructs.  */
+  unsigned work_share_want;
+
   /* This is the saved team state that applied to a master thread before
      the current thread was created.  */
   struct gomp_team_state prev_ts;
@@ -370,47 +617,60 @@ struct gomp_team
      of the threads in the team.  */
   gomp_sem_t **ordered_release;
 
-  /* List of work shares on which gomp_fini_work_share hasn't been
-     called yet.  If the team hasn't been cancelled, this should be
-     equal to each thr->ts.work_share, but otherwise it can be a possibly
-     long list of workshares.  */
-  struct gomp_work_share *work_shares_to_free;
-
-  /* List of gomp_work_share structs chained through next_free fields.
-     This is populated and taken off only by the first thread in the
-     team encountering a new work sharing construct, in a critical
-     section.  */
-  struct gomp_work_share *work_share_list_alloc;
-
-  /* List of gomp_work_share structs freed by free_work_share.  New
-     entries are atomically added to the start of the list, and
-     alloc_work_share can safely only move all but the first entry
-     to work_share_list alloc, as free_work_share can happen concurrently
-     with alloc_work_share.  */
-  struct gomp_work_share *work_share_list_free;
+  /* What the threads of a team drawn from the pool of the master need
+     to set up the other threads of the team, see gomp_team_launch: the
+     function to run, the parent of the implicit tasks and their ICVs.  */
+  void (*launch_fn) (void *);
+  void *launch_data;
+  struct gomp_task *launch_parent;
+  struct gomp_task_icv launch_icv;
+
+  /* The ring of work shares for the work sharing constructs of the
+     team.  Either &work_shares[1], or allocated separately if the team
+     needed more than GOMP_WORK_SHARE_RING slots.  It is kept along with
+     the team in the team cache.  */
+  struct gomp_work_share *work_share_ring;
 
 #ifdef HAVE_SYNC_BUILTINS
   /* Number of simple single regions encountered by threads in this
      team.  */
   unsigned long single_count;
-#else
-  /* Mutex protecting addition of workshares to work_share_list_free.  */
-  gomp_mutex_t work_share_list_free_lock;
 #endif
 
   /* This barrier is used for most synchronization of the team.  */
   gomp_barrier_t barrier;
 
-  /* Initial work shares, to avoid allocating any gomp_work_share
-     structs in the common case.  */
-  struct gomp_work_share work_shares[8];
+  /* The initial work share, used by combined parallel loops and
+     sections, followed by the inline slots of the work share ring.  */
+  struct gomp_work_share work_shares[1 + GOMP_WORK_SHARE_RING];
 
+  /* This lock protects the taskgroup bookkeeping of the team's tasks, as
+     well as TASK_QUEUE and TASK_PRIO_QUEUE.  Dependencies are tracked
+     under the locks of the depend_shards of the parent tasks and the
+     depend_lock of the tasks instead.  */
   gomp_mutex_t task_lock;
+  /* Ready tasks that didn't fit in their creator's deque.  */
   struct gomp_task *task_queue;
+  /* Ready tasks with a priority above zero, which are run before any
+     other, one FIFO queue per priority.  Bit B of TASK_PRIO_MASK is set
+     while TASK_PRIO_QUEUE[B] is not empty.  */
+  unsigned long long task_prio_mask;
+  struct gomp_task *task_prio_queue[GOMP_TASK_PRIO_BUCKETS];
+  /* Per-thread deques of ready tasks, indexed by team_id: MASTER_DEQUE
+     and those in the team slots of the other threads.  */
+  struct gomp_task_deque **task_deques;
+  struct gomp_task_deque master_deque;
+  /* Per-thread barrier slots, indexed by team_id.  */
+  struct gomp_barrier_slot *barrier_slots;
   /* Number of all GOMP_TASK_{WAITING,TIED} tasks in the team.  */
   unsigned int task_count;
   /* Number of GOMP_TASK_WAITING tasks currently waiting to be scheduled.  */
   unsigned int task_queued_count;
+  /* Number of tasks a thread may keep queued in its deque before it
+     runs new ones right away, when the cutoff is adaptive.  */
+  unsigned int task_cutoff;
+  /* Set by threads which ran out of tasks to run in the barrier.  */
+  unsigned int task_starved;
   /* Number of GOMP_TASK_{WAITING,TIED} tasks currently running
      directly in gomp_barrier_handle_tasks; tasks spawned
      from e.g. GOMP_taskwait or GOMP_taskgroup_end don't count, even when
@@ -422,10 +682,51 @@ struct gomp_team
   int work_share_cancelled;
   int team_cancelled;
 
-  /* This array contains structures for implicit tasks.  */
+  /* The implicit task of the master.  Those of the other threads are in
+     their team slots.  */
   struct gomp_task implicit_task[];
 };
 
+/* What a thread of a team leaves for the others at a team barrier, on a
+   cache line of its own rather than next to its task deque, which the
+   thieves hammer.  */
+
+struct gomp_barrier_slot
+{
+  /* The thread's value in gomp_team_barrier_reduce.  */
+  gomp_barrier_value_t partial;
+} __attribute__((aligned (64)));
+
+/* The state of a thread as a member of the teams of its pool it isn't
+   the master of, which the thread allocates and first touches itself
+   when it starts, so that it lives on the NUMA node of the thread rather
+   than on that of the master, who allocates the team.  */
+
+struct gomp_team_slot
+{
+  struct gomp_task_deque deque;
+  struct gomp_task implicit_task;
+};
+
+/* Number of power-of-two size classes of the slab allocator, from 128
+   to 4096 bytes.  */
+#define GOMP_SLAB_CLASSES 6
+
+struct gomp_slab;
+struct gomp_slab_hdr;
+struct gomp_slab_depot;
+
+/* This structure describes the slabs owned by a thread.  */
+
+struct gomp_slab_cache
+{
+  /* Per size class, the slabs with free objects.  */
+  struct gomp_slab *partial[GOMP_SLAB_CLASSES];
+  /* Where other threads return objects of these slabs, allocated with
+     the first slab.  */
+  struct gomp_slab_depot *depot;
+};
+
 /* This structure contains all data that is private to libgomp and is
    allocated per thread.  */
 
@@ -449,19 +750,70 @@ struct gomp_thread
      to any place.  */
   unsigned int place;
 
+  /* State of the generator picking the first victim to steal tasks from.  */
+  unsigned int task_steal_seed;
+
+  /* The untied task this thread has just suspended and queued again,
+     which gomp_task_take only resumes if it finds nothing else to run.  */
+  struct gomp_task *task_suspended;
+
+  /* Adaptive spin estimate for the waits in gomp_barrier_wait_end, mostly
+     at the dock of the thread pool.  */
+  unsigned long barrier_spin_est;
+
+  /* Adaptive spin estimate for the waits in gomp_mutex_lock_slow, of
+     whatever mutexes this thread contends on.  */
+  unsigned long mutex_spin_est;
+
   /* User pthread thread pool */
   struct gomp_thread_pool *thread_pool;
+
+  /* The team slot of a thread of a pool, NULL for other threads.  */
+  struct gomp_team_slot *team_slot;
+
+  /* Pools of the threads of the nested teams this thread is the master
+     of, indexed by the nesting level of the encountering team minus one,
+     as the thread may be the master of an active team on every level.  */
+  struct gomp_thread_pool **nested_pools;
+  unsigned nested_pools_size;
+
+  /* Slabs for task descriptors and their bookkeeping, see alloc.c.  */
+  struct gomp_slab_cache slab_cache;
+
+  /* Set by the master to let the thread leave the dock of its pool, see
+     gomp_barrier_wait_dock.  Written by the master while the thread
+     spins on it, so kept on a cache line of its own.  */
+  int dock_go __attribute__((aligned (64)));
+  /* Adaptive spin estimate for the waits in team barriers, which only
+     this thread touches, and only while the master leaves DOCK_GO be.  */
+  unsigned long team_barrier_spin_est;
 };
 
 
+/* Number of ended teams a thread pool keeps for reuse.  */
+#define GOMP_TEAM_CACHE_SIZE 4
+
 struct gomp_thread_pool
 {
-  /* This array manages threads spawned from the top level, which will
-     return to the idle loop once the current PARALLEL construct ends.  */
+  /* This array manages threads spawned from the top level, or from the
+     master of nested teams owning the pool, which will return to the
+     idle loop once the current PARALLEL construct ends.  */
   struct gomp_thread **threads;
+  /* The deques in the team slots of THREADS, for the teams to copy.  */
+  struct gomp_task_deque **task_deques;
   unsigned threads_size;
   unsigned threads_used;
   struct gomp_team *last_team;
+  /* Teams of the pool that ended before LAST_TEAM, so that their threads
+     are done with them, for gomp_new_team to reuse for as many threads.
+     TEAM_CACHE_NEXT is the slot to evict next when all are taken.  */
+  struct gomp_team *team_cache[GOMP_TEAM_CACHE_SIZE];
+  unsigned team_cache_next;
+  /* The largest work share ring the teams of this pool have needed so
+     far.  New teams get a ring that large, so that deep chains of nowait
+     work sharing constructs don't make threads wait for a free slot.
+     Updated atomically, as nested teams may share the pool.  */
+  unsigned work_share_chunk;
   /* Number of threads running in this contention group.  */
   unsigned long threads_busy;
 
@@ -535,6 +887,12 @@ extern void gomp_affinity_print_place (void *);
 extern void *gomp_malloc (size_t) __attribute__((malloc));
 extern void *gomp_malloc_cleared (size_t) __attribute__((malloc));
 extern void *gomp_realloc (void *, size_t);
+extern void *gomp_aligned_alloc (size_t, size_t) __attribute__((malloc));
+extern void gomp_aligned_free (void *);
+extern void *gomp_slab_alloc (size_t) __attribute__((malloc));
+extern void *gomp_slab_realloc (void *, size_t);
+extern void gomp_slab_free (void *);
+extern void gomp_slab_release (struct gomp_thread *);
 
 /* Avoid conflicting prototypes of alloca() in system headers by using
    GCC's builtin alloca().  */
@@ -554,6 +912,7 @@ extern bool gomp_iter_dynamic_next_locked (long *, long *);
 extern bool gomp_iter_guided_next_locked (long *, long *);
 
 #ifdef HAVE_SYNC_BUILTINS
+extern void gomp_iter_init_pools (struct gomp_work_share *, unsigned);
 extern bool gomp_iter_dynamic_next (long *, long *);
 extern bool gomp_iter_guided_next (long *, long *);
 extern bool gomp_iter_binlpt_next (long *, long *);
@@ -576,6 +935,12 @@ extern bool gomp_iter_ull_guided_next (unsigned long long *,
 				       unsigned long long *);
 #endif
 
+/* loop.c */
+
+extern void gomp_sections_workload (struct gomp_work_share *, unsigned,
+				    unsigned);
+extern unsigned *gomp_taskloop_workload (unsigned long, unsigned long *);
+
 /* ordered.c */
 
 extern void gomp_ordered_first (void);
@@ -584,6 +949,7 @@ extern void gomp_ordered_next (void);
 extern void gomp_ordered_static_init (void);
 extern void gomp_ordered_static_next (void);
 extern void gomp_ordered_sync (void);
+extern void gomp_ordered_handoff (void);
 
 /* parallel.c */
 
@@ -600,12 +966,14 @@ extern void gomp_init_task (struct gomp_task *, struct gomp_task *,
 			    struct gomp_task_icv *);
 extern void gomp_end_task (void);
 extern void gomp_barrier_handle_tasks (gomp_barrier_state_t);
+extern void gomp_task_free_depend_shards (struct gomp_task *);
 
 static void inline
 gomp_finish_task (struct gomp_task *task)
 {
-  if (__builtin_expect (task->depend_hash != NULL, 0))
-    free (task->depend_hash);
+  if (__builtin_expect (task->depend_shards != NULL, 0))
+    gomp_task_free_depend_shards (task);
+  gomp_mutex_destroy (&task->depend_lock);
   gomp_sem_destroy (&task->taskwait_sem);
 }
 
@@ -625,18 +993,14 @@ extern int gomp_get_num_devices (void);
 
 extern void gomp_init_work_share (struct gomp_work_share *, bool, unsigned);
 extern void gomp_fini_work_share (struct gomp_work_share *);
+extern void gomp_init_work_share_pools (struct gomp_work_share *, unsigned);
+extern void gomp_free_work_share_pools (struct gomp_work_share *, unsigned);
 extern bool gomp_work_share_start (bool);
 extern void gomp_work_share_end (void);
 extern bool gomp_work_share_end_cancel (void);
 extern void gomp_work_share_end_nowait (void);
-
-static inline void
-gomp_work_share_init_done (void)
-{
-  struct gomp_thread *thr = gomp_thread ();
-  if (__builtin_expect (thr->ts.last_work_share != NULL, 1))
-    gomp_ptrlock_set (&thr->ts.last_work_share->next_ws, thr->ts.work_share);
-}
+extern void gomp_work_share_init_done (void);
+extern void gomp_work_share_ring_reset (struct gomp_team *);
 
 #ifdef HAVE_ATTRIBUTE_VISIBILITY
 # pragma GCC visibility pop
@@ -53,6 +53,8 @@ struct loop
   char *name;
   unsigned *taskmap;
   bool override;
+  enum gomp_schedule_type sched;
+  unsigned nchunks; /* Chunks taskmap was packed from, BinLPT only. */
 };
 
 static struct loop loops[NR_LOOPS] = { {NULL, NULL, false} };
@@ -399,8 +401,16 @@ static inline void __print_binlpt_debug(unsigned *taskmap,
 
 /**
  * @brief Bin Packing Longest Processing Time First loop scheduler.
+ *
+ * @param tasks    Target tasks.
+ * @param ntasks   Number of tasks.
+ * @param nthreads Number of threads.
+ * @param nchunks  Number of chunks to pack into threads.
+ *
+ * @returns Iteration scheduling map.
  */
-static unsigned *binlpt_balance(unsigned *tasks, unsigned ntasks, unsigned nthreads)
+static unsigned *binlpt_balance(unsigned *tasks, unsigned ntasks,
+                                unsigned nthreads, unsigned nchunks)
 {
   unsigned i;               /* Loop index.       */
   unsigned *taskmap;        /* Task map.         */
@@ -418,14 +428,14 @@ static unsigned *binlpt_balance(unsigned *tasks, unsigned ntasks, unsigned nthre
   load = calloc(nthreads, sizeof(unsigned));
   assert(load != NULL);
 
-  chunksizes = compute_chunksizes(tasks, ntasks, __nchunks);
-  chunks = compute_chunks(tasks, ntasks, chunksizes, __nchunks);
-  chunkoff = compute_cummulativesum(chunksizes, __nchunks);
+  chunksizes = compute_chunksizes(tasks, ntasks, nchunks);
+  chunks = compute_chunks(tasks, ntasks, chunksizes, nchunks);
+  chunkoff = compute_cummulativesum(chunksizes, nchunks);
 
   /* Sort tasks. */
-  sort(chunks, __nchunks, sortmap);
+  sort(chunks, nchunks, sortmap);
 
-  for (i = __nchunks; i > 0; i--)
+  for (i = nchunks; i > 0; i--)
   {
     unsigned j;
     unsigned tid;
@@ -456,6 +466,131 @@ static unsigned *binlpt_balance(unsigned *tasks, unsigned ntasks, unsigned nthre
   return (taskmap);
 }
 
+/*============================================================================*
+ * Sections Scheduling                                                        *
+ *============================================================================*/
+
+/**
+ * @brief Longest Processing Time First ordering of sections.
+ *
+ * @param tasks  Load of sections.
+ * @param ntasks Number of sections.
+ *
+ * @returns Zero-based section numbers, heaviest first.
+ */
+static unsigned *lpt_order(const unsigned *tasks, unsigned ntasks)
+{
+  unsigned i;               /* Loop index.      */
+  unsigned *order;          /* Dispatch order.  */
+  unsigned sortmap[ntasks]; /* Sorting map.     */
+  unsigned load[ntasks];    /* Sorted loads.    */
+
+  order = malloc(ntasks*sizeof(unsigned));
+  assert(order != NULL);
+
+  /* Sort a copy, the user keeps ownership of the workload. */
+  memcpy(load, tasks, ntasks*sizeof(unsigned));
+  sort(load, ntasks, sortmap);
+
+  for (i = 0; i < ntasks; i++)
+    order[i] = sortmap[ntasks - i - 1];
+
+  return (order);
+}
+
+/**
+ * @brief Attaches the workload of the next construct to a SECTIONS
+ * work share.
+ *
+ * The workload set with omp_set_workload() is used if it describes COUNT
+ * sections, and is consumed by doing so.  With OMP_SCHEDULE=binlpt the
+ * sections are pre-partitioned among the threads and WS is turned into a
+ * GFS_BINLPT work share.  Otherwise WS->TASKMAP holds the order in which
+ * the dynamic iterator hands them out, longest first.
+ *
+ * @param ws       Target work share.
+ * @param count    Number of sections.
+ * @param nthreads Number of threads in the team.
+ */
+void gomp_sections_workload(struct gomp_work_share *ws,
+                            unsigned count,
+                            unsigned nthreads)
+{
+  struct loop *loop;
+  enum gomp_schedule_type sched;
+  unsigned nchunks;
+
+  if ((curr_loop < 0) || (__tasks == NULL) || (__ntasks != count))
+    return;
+
+  loop = &loops[curr_loop];
+  sched = (gomp_icv(false)->run_sched_var == GFS_BINLPT)
+    ? GFS_BINLPT : GFS_DYNAMIC;
+  /* Each section is a chunk of its own. */
+  nchunks = (sched == GFS_BINLPT) ? count : 0;
+
+  if (loop->override || loop->taskmap == NULL || loop->sched != sched
+      || loop->nchunks != nchunks) {
+    /* Refresh the mapping. The old one goes with this work share. */
+    ws->taskmap_free = loop->taskmap;
+    if (sched == GFS_BINLPT)
+      loop->taskmap = binlpt_balance(__tasks, count, nthreads, nchunks);
+    else
+      loop->taskmap = lpt_order(__tasks, count);
+    loop->sched = sched;
+    loop->nchunks = nchunks;
+    loop->override = false;
+  }
+  ws->sched = sched;
+  ws->taskmap = loop->taskmap;
+
+  __tasks = NULL;
+}
+
+/*============================================================================*
+ * Taskloop Partitioning                                                      *
+ *============================================================================*/
+
+/**
+ * @brief Splits the workload of the next construct among the tasks of a
+ * TASKLOOP.
+ *
+ * The workload set with omp_set_workload() is used if it describes COUNT
+ * iterations, and is consumed by doing so.  The iterations are cut into
+ * chunks of contiguous iterations of about equal load, the same way BinLPT
+ * does before packing chunks into threads.  Unlike for loops, the result
+ * is not kept in the loop slot, as it is cheap next to the loop itself.
+ *
+ * @param count     Number of iterations.
+ * @param num_tasks Number of tasks wanted, updated with the number of
+ *                  non-empty chunks.
+ *
+ * @returns Number of iterations of each task, to be released with free(),
+ * or NULL if there is no workload for this loop.
+ */
+unsigned *gomp_taskloop_workload(unsigned long count,
+                                 unsigned long *num_tasks)
+{
+  unsigned *chunksizes;
+  unsigned long k;
+
+  if ((curr_loop < 0) || (__tasks == NULL) || (__ntasks != count))
+    return (NULL);
+
+  if (*num_tasks > count)
+    *num_tasks = count;
+  chunksizes = compute_chunksizes(__tasks, __ntasks, *num_tasks);
+
+  /* Heavy iterations may leave the last chunks empty. */
+  for (k = *num_tasks; (k > 1) && (chunksizes[k - 1] == 0); k--)
+    /* noop */;
+  *num_tasks = k;
+
+  __tasks = NULL;
+
+  return (chunksizes);
+}
+
 /*============================================================================*
  * Hacked LibGomp Routines                                                    *
  *============================================================================*/
@@ -505,10 +640,30 @@ gomp_loop_init (struct gomp_work_share *ws, long start, long end, long incr,
         ws->mode = 0;
       else
         ws->mode = ws->end > (nthreads + 1) * -ws->chunk_size - LONG_MAX;
+
+      /* Ordered loops hand out iterations under the work share lock
+         from ws->next, so only unordered loops get split into pools.  */
+      if (ws->ordered_team_ids == NULL)
+        gomp_iter_init_pools (ws, num_threads ? num_threads : nthreads);
     }
 #endif
     break;
 
+#ifdef HAVE_SYNC_BUILTINS
+  case GFS_GUIDED:
+    if (ws->ordered_team_ids == NULL)
+      {
+        if (num_threads == 0)
+          {
+            struct gomp_thread *thr = gomp_thread ();
+            struct gomp_team *team = thr->ts.team;
+            num_threads = (team != NULL) ? team->nthreads : 1;
+          }
+        gomp_iter_init_pools (ws, num_threads);
+      }
+    break;
+#endif
+
   case GFS_BINLPT:
     {
       if (num_threads == 0)
@@ -523,8 +678,7 @@ gomp_loop_init (struct gomp_work_share *ws, long start, long end, long incr,
     }
   case GFS_SRR:
     {
-      unsigned *(*balance)(unsigned *, unsigned, unsigned);
-      balance = (sched == GFS_SRR) ? srr_balance : binlpt_balance;
+      unsigned nchunks = (sched == GFS_BINLPT) ? __nchunks : 0;
       if (num_threads == 0)
         {
           struct gomp_thread *thr = gomp_thread ();
@@ -532,19 +686,27 @@ gomp_loop_init (struct gomp_work_share *ws, long start, long end, long incr,
           num_threads = (team != NULL) ? team->nthreads : 1;
         }
 
+      /* The mapping may have been computed for another schedule, or by
+         gomp_sections_workload for sections rather than loop chunks. */
       struct loop *loop = &loops[curr_loop];
-      if (loop->override || loop->taskmap == NULL) {
-        /* Refresh the mapping. */
-        if (loop->taskmap != NULL) {
-          free(loop->taskmap);
-        }
-        loop->taskmap = balance(__tasks, __ntasks, num_threads);
+      if (loop->override || loop->taskmap == NULL || loop->sched != sched
+          || loop->nchunks != nchunks) {
+        /* Refresh the mapping. The old one goes with this work share. */
+        ws->taskmap_free = loop->taskmap;
+        if (sched == GFS_SRR)
+          loop->taskmap = srr_balance(__tasks, __ntasks, num_threads);
+        else
+          loop->taskmap = binlpt_balance(__tasks, __ntasks, num_threads,
+                                         nchunks);
+        loop->sched = sched;
+        loop->nchunks = nchunks;
+        /* Later constructs with the same workload, such as a chain of
+           nowait loops, must not free the mapping while it is in use. */
+        loop->override = false;
       }
       ws->taskmap = loop->taskmap;
 
       ws->loop_start = start;
-
-      ws->thread_start = (unsigned *) calloc(num_threads, sizeof(int));
     }
     break;
 
@@ -627,6 +789,7 @@ gomp_loop_binlpt_start (long start, long end, long incr, long chunk_size,
   struct gomp_thread *thr = gomp_thread ();
   bool ret;
 
+  thr->ts.taskmap_cursor = 0;
   if (gomp_work_share_start (false))
     {
       gomp_loop_init (thr->ts.work_share, start, end, incr,
@@ -646,6 +809,7 @@ gomp_loop_srr_start (long start, long end, long incr, long chunk_size,
   struct gomp_thread *thr = gomp_thread ();
   bool ret;
 
+  thr->ts.taskmap_cursor = 0;
   if (gomp_work_share_start (false))
     {
       gomp_loop_init (thr->ts.work_share, start, end, incr,
@@ -888,6 +1052,7 @@ gomp_loop_ordered_static_next (long *istart, long *iend)
   int test;
 
   gomp_ordered_sync ();
+  gomp_ordered_handoff ();
   gomp_mutex_lock (&thr->ts.work_share->lock);
   test = gomp_iter_static_next (istart, iend);
   if (test >= 0)
@@ -904,6 +1069,7 @@ gomp_loop_ordered_dynamic_next (long *istart, long *iend)
   bool ret;
 
   gomp_ordered_sync ();
+  gomp_ordered_handoff ();
   gomp_mutex_lock (&thr->ts.work_share->lock);
   ret = gomp_iter_dynamic_next_locked (istart, iend);
   if (ret)
@@ -922,6 +1088,7 @@ gomp_loop_ordered_guided_next (long *istart, long *iend)
   bool ret;
 
   gomp_ordered_sync ();
+  gomp_ordered_handoff ();
   gomp_mutex_lock (&thr->ts.work_share->lock);
   ret = gomp_iter_guided_next_locked (istart, iend);
   if (ret)
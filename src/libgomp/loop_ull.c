@@ -381,6 +381,7 @@ gomp_loop_ull_ordered_static_next (gomp_ull *istart, gomp_ull *iend)
   int test;
 
   gomp_ordered_sync ();
+  gomp_ordered_handoff ();
   gomp_mutex_lock (&thr->ts.work_share->lock);
   test = gomp_iter_ull_static_next (istart, iend);
   if (test >= 0)
@@ -397,6 +398,7 @@ gomp_loop_ull_ordered_dynamic_next (gomp_ull *istart, gomp_ull *iend)
   bool ret;
 
   gomp_ordered_sync ();
+  gomp_ordered_handoff ();
   gomp_mutex_lock (&thr->ts.work_share->lock);
   ret = gomp_iter_ull_dynamic_next_locked (istart, iend);
   if (ret)
@@ -415,6 +417,7 @@ gomp_loop_ull_ordered_guided_next (gomp_ull *istart, gomp_ull *iend)
   bool ret;
 
   gomp_ordered_sync ();
+  gomp_ordered_handoff ();
   gomp_mutex_lock (&thr->ts.work_share->lock);
   ret = gomp_iter_ull_guided_next_locked (istart, iend);
   if (ret)
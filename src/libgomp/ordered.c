@@ -25,6 +25,16 @@
 /* This file handles the ORDERED construct.  */
 
 #include "libgomp.h"
+#include "ticket.h"
+
+/* Two implementations of ORDERED are provided.  The default one keeps a
+   circular queue of team ids in the work share and hands the section over
+   by posting to per-thread semaphores, with the work-share lock held.
+   With GOMP_ORDERED_TICKETS, every iteration block instead carries a
+   ticket: blocks of static loops are numbered in iteration order, blocks
+   of dynamic and guided loops in allocation order.  A thread may enter the
+   section once ws->ordered_serving equals its ticket, and passes it on by
+   bumping that counter, without touching the work-share lock.  */
 
 
 /* This function is called when first allocating an iteration block.  That
@@ -43,6 +53,12 @@ gomp_ordered_first (void)
   if (team == NULL || team->nthreads == 1)
     return;
 
+  if (gomp_ordered_tickets_var)
+    {
+      thr->ts.ordered_ticket = ws->ordered_next_ticket++;
+      return;
+    }
+
   index = ws->ordered_cur + ws->ordered_num_used;
   if (index >= team->nthreads)
     index -= team->nthreads;
@@ -74,6 +90,10 @@ gomp_ordered_last (void)
   if (team == NULL || team->nthreads == 1)
     return;
 
+  /* The ticket has already been passed on by gomp_ordered_handoff.  */
+  if (gomp_ordered_tickets_var)
+    return;
+
   /* We're no longer the owner.  */
   ws->ordered_owner = -1;
 
@@ -109,6 +129,12 @@ gomp_ordered_next (void)
   if (team == NULL || team->nthreads == 1)
     return;
 
+  if (gomp_ordered_tickets_var)
+    {
+      thr->ts.ordered_ticket = ws->ordered_next_ticket++;
+      return;
+    }
+
   /* We're no longer the owner.  */
   ws->ordered_owner = -1;
 
@@ -151,7 +177,8 @@ gomp_ordered_static_init (void)
   struct gomp_thread *thr = gomp_thread ();
   struct gomp_team *team = thr->ts.team;
 
-  if (team == NULL || team->nthreads == 1)
+  /* Ticket zero is served first, as set up by gomp_init_work_share.  */
+  if (team == NULL || team->nthreads == 1 || gomp_ordered_tickets_var)
     return;
 
   gomp_sem_post (team->ordered_release[0]);
@@ -171,7 +198,7 @@ gomp_ordered_static_next (void)
   struct gomp_work_share *ws = thr->ts.work_share;
   unsigned id = thr->ts.team_id;
 
-  if (team == NULL || team->nthreads == 1)
+  if (team == NULL || team->nthreads == 1 || gomp_ordered_tickets_var)
     return;
 
   ws->ordered_owner = -1;
@@ -199,6 +226,14 @@ gomp_ordered_sync (void)
   if (team == NULL || team->nthreads == 1)
     return;
 
+  /* The acquire load of the counter provides the implicit flush.  */
+  if (gomp_ordered_tickets_var)
+    {
+      gomp_ticket_wait (&ws->ordered_serving, &ws->ordered_sleepers,
+			thr->ts.ordered_ticket);
+      return;
+    }
+
   /* ??? I believe it to be safe to access this data without taking the
      ws->lock.  The only presumed race condition is with the previous
      thread on the queue incrementing ordered_cur such that it points
@@ -221,6 +256,27 @@ gomp_ordered_sync (void)
     }
 }
 
+/* This function is called when the thread is done with its current
+   iteration block, after gomp_ordered_sync has made it the owner of the
+   ordered section.  With tickets, the section is passed on to the next
+   block right here, before the work-share lock is taken to allocate more
+   iterations.  Otherwise there's nothing to do, as the hand-off is done by
+   gomp_ordered_next, gomp_ordered_last or gomp_ordered_static_next.  */
+
+void
+gomp_ordered_handoff (void)
+{
+  struct gomp_thread *thr = gomp_thread ();
+  struct gomp_team *team = thr->ts.team;
+  struct gomp_work_share *ws = thr->ts.work_share;
+
+  if (team == NULL || team->nthreads == 1 || !gomp_ordered_tickets_var)
+    return;
+
+  gomp_ticket_serve (&ws->ordered_serving, &ws->ordered_sleepers,
+		     thr->ts.ordered_ticket + 1);
+}
+
 /* This function is called by user code when encountering the start of an
    ORDERED block.  We must check to see if the current thread is at the
    head of the queue, and if not, block.  */
@@ -30,7 +30,8 @@
 /* Initialize the given work share construct from the given arguments.  */
 
 static inline void
-gomp_sections_init (struct gomp_work_share *ws, unsigned count)
+gomp_sections_init (struct gomp_work_share *ws, unsigned count,
+		    unsigned nthreads)
 {
   ws->sched = GFS_DYNAMIC;
   ws->chunk_size = 1;
@@ -53,28 +54,32 @@ gomp_sections_init (struct gomp_work_share *ws, unsigned count)
 #else
   ws->mode = 0;
 #endif
-}
 
-/* This routine is called when first encountering a sections construct
-   that is not bound directly to a parallel construct.  The first thread 
-   that arrives will create the work-share construct; subsequent threads
-   will see the construct exists and allocate work from it.
+  /* Pick up cost hints given with omp_set_workload.  */
+  gomp_sections_workload (ws, count, nthreads);
+}
 
-   COUNT is the number of sections in this construct.
+/* Return the 1-based section number the calling thread performs next, or
+   0 if all sections have been assigned.  */
 
-   Returns the 1-based section number for this thread to perform, or 0 if
-   all work was assigned to other threads prior to this thread's arrival.  */
-
-unsigned
-GOMP_sections_start (unsigned count)
+static unsigned
+gomp_sections_next (void)
 {
   struct gomp_thread *thr = gomp_thread ();
+  struct gomp_work_share *ws = thr->ts.work_share;
   long s, e, ret;
 
-  if (gomp_work_share_start (false))
+  /* Sections were pre-partitioned by BinLPT; look for the next one mapped
+     to this thread.  */
+  if (__builtin_expect (ws->sched == GFS_BINLPT, 0))
     {
-      gomp_sections_init (thr->ts.work_share, count);
-      gomp_work_share_init_done ();
+      unsigned long i, n = ws->end - 1;
+
+      for (i = thr->ts.taskmap_cursor; i < n; i++)
+	if (ws->taskmap[i] == thr->ts.team_id)
+	  break;
+      thr->ts.taskmap_cursor = i + 1;
+      return i < n ? i + 1 : 0;
     }
 
 #ifdef HAVE_SYNC_BUILTINS
@@ -83,17 +88,49 @@ GOMP_sections_start (unsigned count)
   else
     ret = 0;
 #else
-  gomp_mutex_lock (&thr->ts.work_share->lock);
+  gomp_mutex_lock (&ws->lock);
   if (gomp_iter_dynamic_next_locked (&s, &e))
     ret = s;
   else
     ret = 0;
-  gomp_mutex_unlock (&thr->ts.work_share->lock);
+  gomp_mutex_unlock (&ws->lock);
 #endif
 
+  /* Hand out the sections longest first if their costs are known.  */
+  if (ret != 0 && ws->taskmap != NULL)
+    ret = ws->taskmap[ret - 1] + 1;
+
   return ret;
 }
 
+/* This routine is called when first encountering a sections construct
+   that is not bound directly to a parallel construct.  The first thread 
+   that arrives will create the work-share construct; subsequent threads
+   will see the construct exists and allocate work from it.
+
+   COUNT is the number of sections in this construct.
+
+   Returns the 1-based section number for this thread to perform, or 0 if
+   all work was assigned to other threads prior to this thread's arrival.  */
+
+unsigned
+GOMP_sections_start (unsigned count)
+{
+  struct gomp_thread *thr = gomp_thread ();
+
+  thr->ts.taskmap_cursor = 0;
+  if (gomp_work_share_start (false))
+    {
+      struct gomp_team *team = thr->ts.team;
+
+      gomp_sections_init (thr->ts.work_share, count,
+			  team ? team->nthreads : 1);
+      gomp_work_share_init_done ();
+    }
+
+  return gomp_sections_next ();
+}
+
 /* This routine is called when the thread completes processing of the
    section currently assigned to it.  If the work-share construct is
    bound directly to a parallel construct, then the construct may have
@@ -106,25 +143,7 @@ GOMP_sections_start (unsigned count)
 unsigned
 GOMP_sections_next (void)
 {
-  long s, e, ret;
-
-#ifdef HAVE_SYNC_BUILTINS
-  if (gomp_iter_dynamic_next (&s, &e))
-    ret = s;
-  else
-    ret = 0;
-#else
-  struct gomp_thread *thr = gomp_thread ();
-
-  gomp_mutex_lock (&thr->ts.work_share->lock);
-  if (gomp_iter_dynamic_next_locked (&s, &e))
-    ret = s;
-  else
-    ret = 0;
-  gomp_mutex_unlock (&thr->ts.work_share->lock);
-#endif
-
-  return ret;
+  return gomp_sections_next ();
 }
 
 /* This routine pre-initializes a work-share construct to avoid one
@@ -138,7 +157,7 @@ GOMP_parallel_sections_start (void (*fn) (void *), void *data,
 
   num_threads = gomp_resolve_num_threads (num_threads, count);
   team = gomp_new_team (num_threads);
-  gomp_sections_init (&team->work_shares[0], count);
+  gomp_sections_init (&team->work_shares[0], count, num_threads);
   gomp_team_start (fn, data, num_threads, 0, team);
 }
 
@@ -152,7 +171,7 @@ GOMP_parallel_sections (void (*fn) (void *), void *data,
 
   num_threads = gomp_resolve_num_threads (num_threads, count);
   team = gomp_new_team (num_threads);
-  gomp_sections_init (&team->work_shares[0], count);
+  gomp_sections_init (&team->work_shares[0], count, num_threads);
   gomp_team_start (fn, data, num_threads, flags, team);
   fn (data);
   GOMP_parallel_end ();
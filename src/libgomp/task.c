@@ -26,21 +26,24 @@
    creation and termination.  */
 
 #include "libgomp.h"
+#include "context.h"
 #include <stdlib.h>
 #include <string.h>
 
+ialias_redirect (omp_get_wtime)
+
 typedef struct gomp_task_depend_entry *hash_entry_type;
 
 static inline void *
 htab_alloc (size_t size)
 {
-  return gomp_malloc (size);
+  return gomp_slab_alloc (size);
 }
 
 static inline void
 htab_free (void *ptr)
 {
-  free (ptr);
+  gomp_slab_free (ptr);
 }
 
 #include "hashtab.h"
@@ -57,6 +60,50 @@ htab_eq (hash_entry_type x, hash_entry_type y)
   return x->addr == y->addr;
 }
 
+/* Return the shard of the dependency table of PARENT that ADDR belongs
+   to.  */
+
+static inline struct gomp_depend_shard *
+gomp_task_depend_shard (struct gomp_task *parent, void *addr)
+{
+  hashval_t h = hash_pointer (addr) * 0x9e3779b1U;
+  return &parent->depend_shards[(h >> 16) & (GOMP_DEPEND_SHARDS - 1)];
+}
+
+static struct gomp_depend_shard *
+gomp_task_alloc_depend_shards (void)
+{
+  struct gomp_depend_shard *shards
+    = gomp_aligned_alloc (__alignof__ (struct gomp_depend_shard),
+			  GOMP_DEPEND_SHARDS * sizeof (*shards));
+  size_t i;
+
+  for (i = 0; i < GOMP_DEPEND_SHARDS; i++)
+    {
+      gomp_mutex_init (&shards[i].lock);
+      shards[i].hash = NULL;
+    }
+  return shards;
+}
+
+/* Free the dependency table of TASK, once all its children are done.  */
+
+void
+gomp_task_free_depend_shards (struct gomp_task *task)
+{
+  struct gomp_depend_shard *shards = task->depend_shards;
+  size_t i;
+
+  for (i = 0; i < GOMP_DEPEND_SHARDS; i++)
+    {
+      gomp_mutex_destroy (&shards[i].lock);
+      if (shards[i].hash)
+	htab_free (shards[i].hash);
+    }
+  gomp_aligned_free (shards);
+  task->depend_shards = NULL;
+}
+
 /* Create a new task data structure.  */
 
 void
@@ -66,15 +113,22 @@ gomp_init_task (struct gomp_task *task, struct gomp_task *parent_task,
   task->parent = parent_task;
   task->icv = *prev_icv;
   task->kind = GOMP_TASK_IMPLICIT;
-  task->in_taskwait = false;
+  task->refcount = 1;
+  task->priority = 0;
   task->in_tied_task = false;
   task->final_task = false;
   task->copy_ctors_done = false;
-  task->children = NULL;
+  task->depend_done = false;
   task->taskgroup = NULL;
   task->dependers = NULL;
-  task->depend_hash = NULL;
+  task->depend_shards = NULL;
   task->depend_count = 0;
+  task->taskgraph = NULL;
+  task->taskgraph_node = NULL;
+  task->context = NULL;
+  task->untied = false;
+  task->home = 0;
+  gomp_mutex_init (&task->depend_lock);
   gomp_sem_init (&task->taskwait_sem, 0);
 }
 
@@ -90,31 +144,809 @@ gomp_end_task (void)
   thr->task = task->parent;
 }
 
+/* Push TASK at the bottom of DQ.  Only the thread owning DQ may do this.
+   Returns false if DQ is full.  */
+
+static inline bool
+gomp_task_deque_push (struct gomp_task_deque *dq, struct gomp_task *task)
+{
+  long b = __atomic_load_n (&dq->bottom, MEMMODEL_RELAXED);
+  long t = __atomic_load_n (&dq->top, MEMMODEL_ACQUIRE);
+
+  if (b - t >= GOMP_TASK_DEQUE_SIZE)
+    return false;
+  if (__builtin_expect (dq->tasks == NULL, 0))
+    dq->tasks = gomp_malloc (GOMP_TASK_DEQUE_SIZE * sizeof (*dq->tasks));
+  __atomic_store_n (&dq->tasks[b & (GOMP_TASK_DEQUE_SIZE - 1)], task,
+		    MEMMODEL_RELAXED);
+  /* Publish the task, and the tasks array on first use, to thieves.  */
+  __atomic_store_n (&dq->bottom, b + 1, MEMMODEL_RELEASE);
+  return true;
+}
+
+/* Pop the newest task from the bottom of DQ.  Only the thread owning DQ
+   may do this.  Returns NULL if DQ is empty, or if a thief won the race
+   for its last task.  */
+
+static inline struct gomp_task *
+gomp_task_deque_pop (struct gomp_task_deque *dq)
+{
+  long b = __atomic_load_n (&dq->bottom, MEMMODEL_RELAXED);
+  long t = __atomic_load_n (&dq->top, MEMMODEL_RELAXED);
+  struct gomp_task *task;
+
+  /* TOP only ever grows, so this can't claim a non-empty deque empty.  */
+  if (t >= b)
+    return NULL;
+
+  b--;
+  __atomic_store_n (&dq->bottom, b, MEMMODEL_RELAXED);
+  __atomic_thread_fence (MEMMODEL_SEQ_CST);
+  t = __atomic_load_n (&dq->top, MEMMODEL_RELAXED);
+  if (t > b)
+    {
+      __atomic_store_n (&dq->bottom, b + 1, MEMMODEL_RELAXED);
+      return NULL;
+    }
+  task = __atomic_load_n (&dq->tasks[b & (GOMP_TASK_DEQUE_SIZE - 1)],
+			  MEMMODEL_RELAXED);
+  if (t == b)
+    {
+      /* This is the last task, thieves may be after it too.  */
+      if (!__atomic_compare_exchange_n (&dq->top, &t, t + 1, false,
+					MEMMODEL_SEQ_CST, MEMMODEL_RELAXED))
+	task = NULL;
+      __atomic_store_n (&dq->bottom, b + 1, MEMMODEL_RELAXED);
+    }
+  return task;
+}
+
+/* Steal the oldest task from the top of DQ, which is owned by another
+   thread.  Returns NULL if DQ is empty or another thread got there
+   first.  */
+
+static inline struct gomp_task *
+gomp_task_deque_steal (struct gomp_task_deque *dq)
+{
+  long t = __atomic_load_n (&dq->top, MEMMODEL_ACQUIRE);
+  long b;
+  struct gomp_task *task;
+
+  __atomic_thread_fence (MEMMODEL_SEQ_CST);
+  b = __atomic_load_n (&dq->bottom, MEMMODEL_ACQUIRE);
+  if (t >= b)
+    return NULL;
+  task = __atomic_load_n (&dq->tasks[t & (GOMP_TASK_DEQUE_SIZE - 1)],
+			  MEMMODEL_RELAXED);
+  if (!__atomic_compare_exchange_n (&dq->top, &t, t + 1, false,
+				    MEMMODEL_SEQ_CST, MEMMODEL_RELAXED))
+    return NULL;
+  __atomic_add_fetch (&dq->stolen, 1, MEMMODEL_RELAXED);
+  return task;
+}
+
+/* Append TASK to the circular queue starting at *QUEUE.  The lock
+   protecting the queue, usually the team's task_lock, must be held.  */
+
 static inline void
-gomp_clear_parent (struct gomp_task *children)
+gomp_task_queue_append (struct gomp_task **queue, struct gomp_task *task)
+{
+  if (*queue)
+    {
+      task->next_queue = *queue;
+      task->prev_queue = (*queue)->prev_queue;
+      task->next_queue->prev_queue = task;
+      task->prev_queue->next_queue = task;
+    }
+  else
+    {
+      task->next_queue = task;
+      task->prev_queue = task;
+      __atomic_store_n (queue, task, MEMMODEL_RELAXED);
+    }
+}
+
+/* Remove and return the first task of the circular queue starting at
+   *QUEUE, or NULL if it is empty.  The lock protecting the queue, usually
+   the team's task_lock, must be held.  */
+
+static inline struct gomp_task *
+gomp_task_queue_pop (struct gomp_task **queue)
+{
+  struct gomp_task *task = *queue;
+
+  if (task != NULL)
+    {
+      task->prev_queue->next_queue = task->next_queue;
+      task->next_queue->prev_queue = task->prev_queue;
+      __atomic_store_n (queue, task->next_queue != task ? task->next_queue
+			       : NULL, MEMMODEL_RELAXED);
+    }
+  return task;
+}
+
+/* Return true if the tied task scheduling constraints let a thread
+   waiting in tied task ANCESTOR for its children run TASK meanwhile: TASK
+   must be untied, or a descendant of ANCESTOR.  Of the descendants, only
+   children are recognized, as the parent of a deeper one may have
+   completed, and its own parent with it, so the chain can't be walked.
+   That is enough to make progress, as ANCESTOR only waits for its
+   children; gomp_task_take moves deeper descendants out of the way.
+   A NULL ANCESTOR allows any task.  */
+
+static inline bool
+gomp_task_allowed (struct gomp_task *task, struct gomp_task *ancestor)
+{
+  return ancestor == NULL || task->untied || task->parent == ancestor;
+}
+
+/* Remove and return the first task of the circular queue starting at
+   *QUEUE that gomp_task_allowed lets run under ANCESTOR, or NULL.  The
+   lock protecting the queue must be held.  */
+
+static struct gomp_task *
+gomp_task_queue_take (struct gomp_task **queue, struct gomp_task *ancestor)
 {
-  struct gomp_task *task = children;
+  struct gomp_task *task = *queue;
 
-  if (task)
-    do
+  if (task == NULL || gomp_task_allowed (task, ancestor))
+    return gomp_task_queue_pop (queue);
+  for (task = task->next_queue; task != *queue; task = task->next_queue)
+    if (gomp_task_allowed (task, ancestor))
       {
-	task->parent = NULL;
-	task = task->next_child;
+	task->prev_queue->next_queue = task->next_queue;
+	task->next_queue->prev_queue = task->prev_queue;
+	return task;
       }
-    while (task != children);
+  return NULL;
+}
+
+/* Remove and return the oldest task of the inbox of DQ that may run
+   under ANCESTOR, or NULL.  */
+
+static inline struct gomp_task *
+gomp_task_inbox_pop (struct gomp_task_deque *dq, struct gomp_task *ancestor)
+{
+  struct gomp_task *task;
+
+  if (__atomic_load_n (&dq->inbox, MEMMODEL_RELAXED) == NULL)
+    return NULL;
+  gomp_mutex_lock (&dq->inbox_lock);
+  task = gomp_task_queue_take (&dq->inbox, ancestor);
+  gomp_mutex_unlock (&dq->inbox_lock);
+  return task;
+}
+
+/* Make TASK, which is ready to run, available to the team.  It goes to
+   the calling thread's deque, or to the overflow queue if that is full,
+   unless it has a priority, in which case it goes to the team's queue for
+   that priority.  A task released by its dependencies goes to the inbox
+   of its home thread instead, which completed the producer of its data
+   and likely still has it in cache.  LOCKED says whether the caller holds
+   team->task_lock.  */
+
+static void
+gomp_task_enqueue (struct gomp_thread *thr, struct gomp_team *team,
+		   struct gomp_task *task, bool locked)
+{
+  __atomic_add_fetch (&team->task_queued_count, 1, MEMMODEL_SEQ_CST);
+  if (__builtin_expect (task->priority > 0, 0))
+    {
+      unsigned int b = task->priority < GOMP_TASK_PRIO_BUCKETS
+		       ? task->priority : GOMP_TASK_PRIO_BUCKETS - 1;
+
+      if (!locked)
+	gomp_mutex_lock (&team->task_lock);
+      gomp_task_queue_append (&team->task_prio_queue[b], task);
+      __atomic_store_n (&team->task_prio_mask,
+			team->task_prio_mask | (1ULL << b), MEMMODEL_RELAXED);
+      if (!locked)
+	gomp_mutex_unlock (&team->task_lock);
+    }
+  else if (__builtin_expect (task->home != 0, 0)
+	   && task->home - 1 != thr->ts.team_id
+	   && task->context == NULL)
+    {
+      struct gomp_task_deque *dq = team->task_deques[task->home - 1];
+
+      gomp_mutex_lock (&dq->inbox_lock);
+      gomp_task_queue_append (&dq->inbox, task);
+      gomp_mutex_unlock (&dq->inbox_lock);
+    }
+  /* A suspended untied task goes to the overflow queue, behind the tasks
+     in the deque, one of which it may be waiting for.  */
+  else if (__builtin_expect (task->context != NULL
+			     || !gomp_task_deque_push (team->task_deques
+						       [thr->ts.team_id],
+						       task), 0))
+    {
+      if (!locked)
+	gomp_mutex_lock (&team->task_lock);
+      gomp_task_queue_append (&team->task_queue, task);
+      if (!locked)
+	gomp_mutex_unlock (&team->task_lock);
+    }
+
+  /* Threads in the barrier only look for tasks while BAR_TASK_PENDING is
+     set.  Together with the seq-cst increment of task_queued_count above,
+     this pairs with gomp_task_clear_pending.  */
+  if (!gomp_team_barrier_task_pending (&team->barrier))
+    {
+      if (!locked)
+	gomp_mutex_lock (&team->task_lock);
+      gomp_team_barrier_set_task_pending (&team->barrier);
+      if (!locked)
+	gomp_mutex_unlock (&team->task_lock);
+    }
+}
+
+/* Find a ready task for THR to run: the oldest one of highest priority,
+   if any task has a priority, else the oldest one in its inbox, else the
+   newest one in its own deque, else the oldest one of the overflow queue,
+   else the oldest one of some other thread's deque or inbox.  An untied
+   task THR has just suspended is only resumed if nothing else is found,
+   so that a yielding task lets others run.  Only tasks that
+   gomp_task_allowed lets run under ANCESTOR are returned; a thread
+   waiting in a tied task passes that task, and leaves all others to the
+   threads in the barrier.  Returns NULL if none was found.  */
+
+static struct gomp_task *
+gomp_task_take (struct gomp_thread *thr, struct gomp_team *team,
+		struct gomp_task *ancestor)
+{
+  struct gomp_task_deque *dq = team->task_deques[thr->ts.team_id];
+  unsigned nthreads = team->nthreads;
+  unsigned i, victim;
+  struct gomp_task *task = NULL, *suspended = NULL;
+
+  if (__builtin_expect (__atomic_load_n (&team->task_prio_mask,
+					 MEMMODEL_RELAXED) != 0, 0))
+    {
+      unsigned long long mask;
+
+      gomp_mutex_lock (&team->task_lock);
+      for (mask = team->task_prio_mask; mask != 0 && task == NULL; )
+	{
+	  unsigned int b = 63 - __builtin_clzll (mask);
+
+	  task = gomp_task_queue_take (&team->task_prio_queue[b], ancestor);
+	  if (team->task_prio_queue[b] == NULL)
+	    __atomic_store_n (&team->task_prio_mask,
+			      team->task_prio_mask & ~(1ULL << b),
+			      MEMMODEL_RELAXED);
+	  mask &= ~(1ULL << b);
+	}
+      gomp_mutex_unlock (&team->task_lock);
+    }
+  if (task == NULL)
+    task = gomp_task_inbox_pop (dq, ancestor);
+  if (task == NULL)
+    {
+      task = gomp_task_deque_pop (dq);
+      if (task != NULL && !gomp_task_allowed (task, ancestor))
+	{
+	  /* A child of ANCESTOR may well be further down, below tasks its
+	     siblings created.  Move the tasks in the way to the overflow
+	     queue, where the threads in the barrier, or waiting in their
+	     parent, find them.  */
+	  gomp_mutex_lock (&team->task_lock);
+	  do
+	    {
+	      gomp_task_queue_append (&team->task_queue, task);
+	      task = gomp_task_deque_pop (dq);
+	    }
+	  while (task != NULL && !gomp_task_allowed (task, ancestor));
+	  gomp_mutex_unlock (&team->task_lock);
+	  gomp_team_barrier_wake (&team->barrier, 1);
+	}
+    }
+  if (task == NULL
+      && __atomic_load_n (&team->task_queue, MEMMODEL_RELAXED) != NULL)
+    {
+      gomp_mutex_lock (&team->task_lock);
+      task = gomp_task_queue_take (&team->task_queue, ancestor);
+      gomp_mutex_unlock (&team->task_lock);
+      if (__builtin_expect (task != NULL && task == thr->task_suspended, 0))
+	{
+	  suspended = task;
+	  task = NULL;
+	}
+    }
+  if (task == NULL && nthreads > 1
+      && __atomic_load_n (&team->task_queued_count, MEMMODEL_RELAXED) != 0)
+    {
+      /* Start at a pseudo-random victim, so that thieves spread out.  */
+      thr->task_steal_seed = thr->task_steal_seed * 1103515245 + 12345;
+      victim = ((thr->task_steal_seed >> 16) + thr->ts.team_id + 1)
+	       % nthreads;
+      for (i = 0; i < nthreads && task == NULL; i++)
+	{
+	  if (victim != thr->ts.team_id)
+	    {
+	      task = gomp_task_deque_steal (team->task_deques[victim]);
+	      if (task != NULL && !gomp_task_allowed (task, ancestor))
+		{
+		  /* It can't go back to the top of the victim's deque, so
+		     hand it to some thread in the barrier through the
+		     overflow queue.  */
+		  gomp_mutex_lock (&team->task_lock);
+		  gomp_task_queue_append (&team->task_queue, task);
+		  gomp_mutex_unlock (&team->task_lock);
+		  gomp_team_barrier_wake (&team->barrier, 1);
+		  task = NULL;
+		}
+	      if (task == NULL)
+		task = gomp_task_inbox_pop (team->task_deques[victim],
+					    ancestor);
+	    }
+	  if (++victim == nthreads)
+	    victim = 0;
+	}
+    }
+  if (__builtin_expect (suspended != NULL, 0))
+    {
+      if (task == NULL)
+	task = suspended;
+      else
+	{
+	  gomp_mutex_lock (&team->task_lock);
+	  gomp_task_queue_append (&team->task_queue, suspended);
+	  gomp_mutex_unlock (&team->task_lock);
+	}
+    }
+  if (task != NULL)
+    {
+      thr->task_suspended = NULL;
+      __atomic_sub_fetch (&team->task_queued_count, 1, MEMMODEL_RELAXED);
+    }
+  return task;
+}
+
+/* Called by a thread in the barrier which couldn't find any task to run.
+   Clears BAR_TASK_PENDING, unless tasks were queued meanwhile, in which
+   case true is returned.  */
+
+static bool
+gomp_task_clear_pending (struct gomp_team *team)
+{
+  bool pending;
+
+  gomp_mutex_lock (&team->task_lock);
+  gomp_team_barrier_clear_task_pending (&team->barrier);
+  __atomic_thread_fence (MEMMODEL_SEQ_CST);
+  pending = __atomic_load_n (&team->task_queued_count, MEMMODEL_RELAXED) != 0;
+  if (pending)
+    gomp_team_barrier_set_task_pending (&team->barrier);
+  gomp_mutex_unlock (&team->task_lock);
+  return pending;
+}
+
+/* Drop a reference to TASK.  Frees a deferred task once it has completed
+   and all its children have too, and wakes a task sleeping in
+   gomp_task_wait_children when its last child is done.  */
+
+static inline void
+gomp_task_unref (struct gomp_task *task)
+{
+  unsigned int ref = __atomic_sub_fetch (&task->refcount, 1,
+					 MEMMODEL_ACQ_REL);
+
+  if (ref == 0)
+    {
+      gomp_finish_task (task);
+      gomp_slab_free (task);
+    }
+  else if (ref == (GOMP_TASK_REF_WAITING | 1))
+    {
+      /* TASK sleeps until we post, so it is safe to touch it.  */
+      __atomic_store_n (&task->refcount, 1, MEMMODEL_RELAXED);
+      gomp_sem_post (&task->taskwait_sem);
+    }
+}
+
+/* Wake up TASK if it sleeps in gomp_task_wait_children, because one of
+   its children was just queued by gomp_task_enqueue.  The seq-cst load
+   pairs with the check of task_queued_count there: either we see the
+   flag, or TASK sees the queued child and doesn't sleep.  */
+
+static inline void
+gomp_task_wake (struct gomp_task *task)
+{
+  unsigned int ref = __atomic_load_n (&task->refcount, MEMMODEL_SEQ_CST);
+
+  while (ref & GOMP_TASK_REF_WAITING)
+    if (__atomic_compare_exchange_n (&task->refcount, &ref,
+				     ref & ~GOMP_TASK_REF_WAITING, false,
+				     MEMMODEL_ACQ_REL, MEMMODEL_RELAXED))
+      {
+	gomp_sem_post (&task->taskwait_sem);
+	break;
+      }
+}
+
+/* The adaptive task cutoff.  Each thread keeps at most team->task_cutoff
+   tasks in its deque; tasks it creates beyond that are run right away.
+   Every GOMP_TASK_CUTOFF_EPOCH task creations, the creating thread looks
+   at how many of its tasks were stolen meanwhile and whether threads went
+   idle in the barrier: if so, the team needs more parallel slack and the
+   cutoff doubles.  If instead the tasks stay where they are and are so
+   short that queueing them costs about as much as running them, it
+   halves.  The cutoff stays between GOMP_TASK_CUTOFF_MIN and
+   GOMP_TASK_CUTOFF_MAX; when the two are equal, the old fixed cutoff on
+   the number of tasks of the team is used instead.  */
+
+#define GOMP_TASK_CUTOFF_EPOCH 64
+#define GOMP_TASK_SAMPLE 16
+#define GOMP_TASK_TINY_NS 2000
+
+static void
+gomp_task_adapt_cutoff (struct gomp_team *team, struct gomp_task_deque *dq)
+{
+  unsigned long stolen = __atomic_load_n (&dq->stolen, MEMMODEL_RELAXED);
+  unsigned long nstolen = stolen - dq->last_stolen;
+  unsigned long cutoff = __atomic_load_n (&team->task_cutoff,
+					  MEMMODEL_RELAXED);
+  bool starved = __atomic_load_n (&team->task_starved, MEMMODEL_RELAXED);
+
+  dq->last_stolen = stolen;
+  if (starved)
+    __atomic_store_n (&team->task_starved, 0, MEMMODEL_RELAXED);
+
+  if (starved || nstolen * 4 >= GOMP_TASK_CUTOFF_EPOCH)
+    cutoff *= 2;
+  else if (nstolen * 16 < GOMP_TASK_CUTOFF_EPOCH
+	   && dq->avg_run_ns < GOMP_TASK_TINY_NS)
+    cutoff /= 2;
+  if (cutoff < gomp_task_cutoff_min_var)
+    cutoff = gomp_task_cutoff_min_var;
+  if (cutoff > gomp_task_cutoff_max_var)
+    cutoff = gomp_task_cutoff_max_var;
+  __atomic_store_n (&team->task_cutoff, cutoff, MEMMODEL_RELAXED);
+}
+
+/* Return true if a task THR is about to create should be run right away
+   rather than deferred.  */
+
+static inline bool
+gomp_task_cutoff (struct gomp_thread *thr, struct gomp_team *team)
+{
+  struct gomp_task_deque *dq;
+  long depth;
+
+  if (team->task_count > gomp_task_cutoff_max_var * team->nthreads)
+    return true;
+  if (gomp_task_cutoff_min_var == gomp_task_cutoff_max_var)
+    return false;
+
+  dq = team->task_deques[thr->ts.team_id];
+  if (++dq->created % GOMP_TASK_CUTOFF_EPOCH == 0)
+    gomp_task_adapt_cutoff (team, dq);
+  depth = (__atomic_load_n (&dq->bottom, MEMMODEL_RELAXED)
+	   - __atomic_load_n (&dq->top, MEMMODEL_RELAXED));
+  return depth >= (long) __atomic_load_n (&team->task_cutoff,
+					  MEMMODEL_RELAXED);
+}
+
+/* Call FN (DATA), the body of a task THR runs in TEAM.  Every
+   GOMP_TASK_SAMPLE runs, time it for the average run time used by the
+   adaptive cutoff.  */
+
+static inline void
+gomp_task_call (struct gomp_thread *thr, struct gomp_team *team,
+		void (*fn) (void *), void *data)
+{
+  struct gomp_task_deque *dq;
+  unsigned long ns;
+  double start;
+
+  if (team == NULL || gomp_task_cutoff_min_var == gomp_task_cutoff_max_var)
+    {
+      fn (data);
+      return;
+    }
+  dq = team->task_deques[thr->ts.team_id];
+  if (dq->runs++ % GOMP_TASK_SAMPLE != 0)
+    {
+      fn (data);
+      return;
+    }
+  start = omp_get_wtime ();
+  fn (data);
+  ns = (omp_get_wtime () - start) * 1e9;
+  dq->avg_run_ns = (dq->avg_run_ns * 7 + ns) / 8;
+}
+
+static void gomp_task_wait_children (struct gomp_thread *,
+				     struct gomp_team *, struct gomp_task *);
+static size_t gomp_taskgraph_run_post (struct gomp_thread *,
+				       struct gomp_team *,
+				       struct gomp_taskgraph_node *);
+
+/* Make TASK wait for TSK, an earlier sibling with a conflicting depend
+   clause, unless TSK has completed meanwhile.  WRITER says whether that
+   clause of TSK is an out or inout one.  */
+
+static void
+gomp_task_add_depender (struct gomp_task *tsk, struct gomp_task *task,
+			bool writer)
+{
+  struct gomp_dependers_vec *dependers;
+  uintptr_t tag = writer ? GOMP_DEPENDER_WRITER : 0;
+
+  gomp_mutex_lock (&tsk->depend_lock);
+  if (tsk->depend_done)
+    {
+      gomp_mutex_unlock (&tsk->depend_lock);
+      return;
+    }
+  dependers = tsk->dependers;
+  if (dependers == NULL)
+    {
+      dependers = gomp_slab_alloc (sizeof (struct gomp_dependers_vec)
+				   + 6 * sizeof (struct gomp_task *));
+      dependers->n_elem = 0;
+      dependers->allocated = 6;
+    }
+  /* We already have some other dependency on tsk from earlier depend
+     clause.  */
+  else if (dependers->n_elem
+	   && ((uintptr_t) dependers->elem[dependers->n_elem - 1]
+	       & ~GOMP_DEPENDER_WRITER) == (uintptr_t) task)
+    {
+      dependers->elem[dependers->n_elem - 1]
+	= (struct gomp_task *) ((uintptr_t) dependers->elem[dependers->n_elem
+							     - 1] | tag);
+      gomp_mutex_unlock (&tsk->depend_lock);
+      return;
+    }
+  else if (dependers->n_elem == dependers->allocated)
+    {
+      dependers->allocated = dependers->allocated * 2 + 2;
+      dependers = gomp_slab_realloc (dependers,
+				     sizeof (struct gomp_dependers_vec)
+				     + (dependers->allocated
+					* sizeof (struct gomp_task *)));
+    }
+  dependers->elem[dependers->n_elem++]
+    = (struct gomp_task *) ((uintptr_t) task | tag);
+  tsk->dependers = dependers;
+  __atomic_add_fetch (&task->num_dependees, 1, MEMMODEL_RELAXED);
+  gomp_mutex_unlock (&tsk->depend_lock);
+}
+
+/* Record the depend clauses DEPEND of TASK, a new deferred child of
+   PARENT, in the dependency table of PARENT, and make TASK wait for the
+   earlier siblings it conflicts with.  Returns true if any of those is
+   still to complete; the last one of them to do so queues TASK.  Only
+   the thread running PARENT adds to its table, but its children remove
+   their entries concurrently as they complete, each shard under its own
+   lock.  */
+
+static bool
+gomp_task_add_depend (struct gomp_task *task, struct gomp_task *parent,
+		      void **depend)
+{
+  size_t ndepend = (uintptr_t) depend[0];
+  size_t nout = (uintptr_t) depend[1];
+  size_t i;
+  hash_entry_type ent;
+
+  task->depend_count = ndepend;
+  /* Keep TASK from being released before all its clauses are recorded.  */
+  task->num_dependees = 1;
+  if (parent->depend_shards == NULL)
+    parent->depend_shards = gomp_task_alloc_depend_shards ();
+  for (i = 0; i < ndepend; i++)
+    {
+      struct gomp_depend_shard *shard;
+
+      task->depend[i].addr = depend[2 + i];
+      task->depend[i].next = NULL;
+      task->depend[i].prev = NULL;
+      task->depend[i].task = task;
+      task->depend[i].is_in = i >= nout;
+      task->depend[i].redundant = false;
+
+      shard = gomp_task_depend_shard (parent, task->depend[i].addr);
+      gomp_mutex_lock (&shard->lock);
+      if (shard->hash == NULL)
+	shard->hash = htab_create (12);
+      hash_entry_type *slot
+	= htab_find_slot (&shard->hash, &task->depend[i], INSERT);
+      hash_entry_type out = NULL;
+      if (*slot)
+	{
+	  /* If multiple depends on the same task are the same, all but the
+	     first one are redundant.  As inout/out come first, if any of
+	     them is inout/out, it will win, which is the right
+	     semantics.  */
+	  if ((*slot)->task == task)
+	    {
+	      task->depend[i].redundant = true;
+	      gomp_mutex_unlock (&shard->lock);
+	      continue;
+	    }
+	  for (ent = *slot; ent; ent = ent->next)
+	    {
+	      /* depend(in:...) doesn't depend on earlier depend(in:...).  */
+	      if (i >= nout && ent->is_in)
+		continue;
+
+	      if (!ent->is_in)
+		out = ent;
+
+	      gomp_task_add_depender (ent->task, task, !ent->is_in);
+	    }
+	  task->depend[i].next = *slot;
+	  (*slot)->prev = &task->depend[i];
+	}
+      *slot = &task->depend[i];
+
+      /* There is no need to store more than one depend({,in}out:) task per
+	 address in the hash table chain, because each out depends on all
+	 earlier outs, thus it is enough to record just the last
+	 depend({,in}out:).  For depend(in:), we need to keep all of the
+	 previous ones not terminated yet, because a later
+	 depend({,in}out:) might need to depend on all of them.  So, if the
+	 new task's clause is depend({,in}out:), we know there is at most
+	 one other depend({,in}out:) clause in the list (out) and to
+	 maintain the invariant we now need to remove it from the list.  */
+      if (!task->depend[i].is_in && out)
+	{
+	  if (out->next)
+	    out->next->prev = out->prev;
+	  out->prev->next = out->next;
+	  out->redundant = true;
+	}
+      gomp_mutex_unlock (&shard->lock);
+    }
+  return __atomic_sub_fetch (&task->num_dependees, 1, MEMMODEL_ACQ_REL) != 0;
+}
+
+/* Task graphs.  A task that runs the same set of tasks over and over,
+   such as one time step of a solver after another, can enclose their
+   creation in omp_taskgraph_begin and omp_taskgraph_end.  The first time
+   around, the tasks run as usual, and their functions and depend clauses
+   are recorded.  omp_taskgraph_end then works out the dependencies among
+   them once and for all.  From then on, the K-th task created in the
+   region is matched against the K-th node of the graph, and its
+   dependencies are tracked with the precomputed counter and successors of
+   the node, without going through the dependency table of the parent.  A
+   task that doesn't match makes the runtime wait for the tasks created so
+   far and drop the graph, which is recorded again the next time.  A
+   task that may not be deferred, because of an if clause or a final
+   parent, still runs right away when replayed, once its predecessors are
+   done, and then releases its successors itself.  */
+
+#define GOMP_TASKGRAPH_MAX 64
+
+static struct gomp_taskgraph *gomp_taskgraphs[GOMP_TASKGRAPH_MAX];
+
+/* Protects gomp_taskgraphs and the active flags of the graphs, as tasks
+   of different teams may begin and end graphs concurrently.  */
+static gomp_mutex_t gomp_taskgraph_lock;
+
+#if !GOMP_MUTEX_INIT_0
+static void __attribute__((constructor))
+initialize_taskgraph (void)
+{
+  gomp_mutex_init (&gomp_taskgraph_lock);
+}
+#endif
+
+/* Forget everything recorded in GRAPH.  */
+
+static void
+gomp_taskgraph_clear (struct gomp_taskgraph *graph)
+{
+  unsigned i;
+
+  for (i = 0; i < graph->nnodes; i++)
+    free (graph->nodes[i].depend);
+  free (graph->nodes);
+  free (graph->succs);
+  graph->nodes = NULL;
+  graph->nnodes = 0;
+  graph->allocated = 0;
+  graph->succs = NULL;
+  graph->recorded = false;
+}
+
+/* Append a node for a task running FN with depend clauses DEPEND, if
+   FLAGS says there are any, to GRAPH.  */
+
+static void
+gomp_taskgraph_record (struct gomp_taskgraph *graph, void (*fn) (void *),
+		       unsigned flags, void **depend)
+{
+  struct gomp_taskgraph_node *node;
+
+  if (graph->nnodes == graph->allocated)
+    {
+      graph->allocated = graph->allocated * 2 + 16;
+      graph->nodes = gomp_realloc (graph->nodes, graph->allocated
+					       * sizeof (*graph->nodes));
+    }
+  node = &graph->nodes[graph->nnodes++];
+  memset (node, 0, sizeof (*node));
+  node->graph = graph;
+  node->fn = fn;
+  if (flags & GOMP_TASK_FLAG_DEPEND)
+    {
+      node->ndepend = (uintptr_t) depend[0];
+      node->nout = (uintptr_t) depend[1];
+      node->depend = gomp_malloc (node->ndepend * sizeof (void *));
+      memcpy (node->depend, depend + 2, node->ndepend * sizeof (void *));
+    }
+}
+
+/* Called by GOMP_task when PARENT, running on THR, creates a task running
+   FN with depend clauses DEPEND within a task graph region.  Returns the
+   node of the task if the graph is being replayed and the task matches
+   it, else NULL, in which case the task goes through the usual
+   dependency tracking.  */
+
+static struct gomp_taskgraph_node *
+gomp_taskgraph_task (struct gomp_thread *thr, struct gomp_task *parent,
+		     void (*fn) (void *), unsigned flags, void **depend)
+{
+  struct gomp_taskgraph *graph = parent->taskgraph;
+  struct gomp_taskgraph_node *node;
+  size_t ndepend
+    = (flags & GOMP_TASK_FLAG_DEPEND) ? (uintptr_t) depend[0] : 0;
+
+  if (!graph->recorded)
+    {
+      gomp_taskgraph_record (graph, fn, flags, depend);
+      return NULL;
+    }
+
+  if (graph->next < graph->nnodes)
+    {
+      node = &graph->nodes[graph->next];
+      if (node->fn == fn
+	  && node->ndepend == ndepend
+	  && (ndepend == 0
+	      || (node->nout == (uintptr_t) depend[1]
+		  && memcmp (node->depend, depend + 2,
+			     ndepend * sizeof (void *)) == 0)))
+	{
+	  graph->next++;
+	  return node;
+	}
+    }
+
+  /* The tasks replayed so far aren't in the dependency table, so later
+     tasks can't find them there.  Wait for them instead.  */
+  if (__atomic_load_n (&parent->refcount, MEMMODEL_ACQUIRE) != 1)
+    gomp_task_wait_children (thr, thr->ts.team, parent);
+  gomp_mutex_lock (&gomp_taskgraph_lock);
+  gomp_taskgraph_clear (graph);
+  graph->active = false;
+  gomp_mutex_unlock (&gomp_taskgraph_lock);
+  parent->taskgraph = NULL;
+  return NULL;
 }
 
 /* Called when encountering an explicit task directive.  If IF_CLAUSE is
    false, then we must not delay in executing the task.  If UNTIED is true,
-   then the task may be executed by any member of the team.  */
+   then the task may be executed by any member of the team.  PRIORITY is
+   only valid if bit 4 of FLAGS is set; callers predating the priority
+   clause never set it.  */
 
 void
 GOMP_task (void (*fn) (void *), void *data, void (*cpyfn) (void *, void *),
 	   long arg_size, long arg_align, bool if_clause, unsigned flags,
-	   void **depend)
+	   void **depend, int priority)
 {
   struct gomp_thread *thr = gomp_thread ();
   struct gomp_team *team = thr->ts.team;
+  struct gomp_taskgraph_node *node = NULL, *inline_node = NULL;
+
+  if ((flags & GOMP_TASK_FLAG_PRIORITY) == 0 || priority < 0)
+    priority = 0;
+  else if (priority > gomp_max_task_priority_var)
+    priority = gomp_max_task_priority_var;
 
 #ifdef HAVE_BROKEN_POSIX_SEMAPHORES
   /* If pthread_mutex_* is used for omp_*lock*, then each task must be
@@ -123,19 +955,39 @@ GOMP_task (void (*fn) (void *), void *data, void (*cpyfn) (void *, void *),
      might be running on different thread than FN.  */
   if (cpyfn)
     if_clause = false;
-  if (flags & 1)
-    flags &= ~1;
+  if (flags & GOMP_TASK_FLAG_UNTIED)
+    flags &= ~GOMP_TASK_FLAG_UNTIED;
 #endif
 
-  /* If parallel or taskgroup has been cancelled, don't start new tasks.  */
+  if (__builtin_expect (thr->task && thr->task->taskgraph, 0))
+    node = gomp_taskgraph_task (thr, thr->task, fn, flags, depend);
+
+  /* If parallel or taskgroup has been cancelled, don't start new tasks.
+     A replayed task is still queued, to release its successors, but
+     gomp_task_run won't run it.  */
   if (team
       && (gomp_team_barrier_cancelled (&team->barrier)
-	  || (thr->task->taskgroup && thr->task->taskgroup->cancelled)))
+	  || (thr->task->taskgroup && thr->task->taskgroup->cancelled))
+      && node == NULL)
     return;
 
-  if (!if_clause || team == NULL
-      || (thr->task && thr->task->final_task)
-      || team->task_count > 64 * team->nthreads)
+  /* A replayed task that may not be deferred runs right away if its
+     predecessors are done.  Else it is deferred, like any such task
+     whose dependencies aren't satisfied yet; so are all other replayed
+     tasks, as their successors count on them.  */
+  if (__builtin_expect (node != NULL, 0)
+      && (!if_clause || thr->task->final_task)
+      && __atomic_load_n (&node->pending, MEMMODEL_ACQUIRE) == 1)
+    {
+      __atomic_store_n (&node->pending, 0, MEMMODEL_RELAXED);
+      inline_node = node;
+      node = NULL;
+    }
+
+  if (node == NULL
+      && (!if_clause || team == NULL
+	  || (thr->task && thr->task->final_task)
+	  || gomp_task_cutoff (thr, team)))
     {
       struct gomp_task task;
 
@@ -146,34 +998,37 @@ GOMP_task (void (*fn) (void *), void *data, void (*cpyfn) (void *, void *),
 	 depend clauses for non-deferred tasks other than this, because
 	 the parent task is suspended until the child task finishes and thus
 	 it can't start further child tasks.  */
-      if ((flags & 8) && thr->task && thr->task->depend_hash)
+      if ((flags & GOMP_TASK_FLAG_DEPEND) && inline_node == NULL
+	  && thr->task && thr->task->depend_shards)
 	{
 	  struct gomp_task *parent = thr->task;
 	  struct gomp_task_depend_entry elem, *ent = NULL;
 	  size_t ndepend = (uintptr_t) depend[0];
 	  size_t nout = (uintptr_t) depend[1];
 	  size_t i;
-	  gomp_mutex_lock (&team->task_lock);
 	  for (i = 0; i < ndepend; i++)
 	    {
+	      struct gomp_depend_shard *shard;
+
 	      elem.addr = depend[i + 2];
-	      ent = htab_find (parent->depend_hash, &elem);
+	      shard = gomp_task_depend_shard (parent, elem.addr);
+	      gomp_mutex_lock (&shard->lock);
+	      ent = shard->hash ? htab_find (shard->hash, &elem) : NULL;
 	      for (; ent; ent = ent->next)
 		if (i >= nout && ent->is_in)
 		  continue;
 		else
 		  break;
+	      gomp_mutex_unlock (&shard->lock);
 	      if (ent)
-		break;
+		goto defer;
 	    }
-	  gomp_mutex_unlock (&team->task_lock);
-	  if (ent)
-	    goto defer;
 	}
 
       gomp_init_task (&task, thr->task, gomp_icv (false));
       task.kind = GOMP_TASK_IFFALSE;
-      task.final_task = (thr->task && thr->task->final_task) || (flags & 2);
+      task.final_task = (thr->task && thr->task->final_task)
+			|| (flags & GOMP_TASK_FLAG_FINAL);
       if (thr->task)
 	{
 	  task.in_tied_task = thr->task->in_tied_task;
@@ -186,26 +1041,25 @@ GOMP_task (void (*fn) (void *), void *data, void (*cpyfn) (void *, void *),
 	  char *arg = (char *) (((uintptr_t) buf + arg_align - 1)
 				& ~(uintptr_t) (arg_align - 1));
 	  cpyfn (arg, data);
-	  fn (arg);
+	  gomp_task_call (thr, team, fn, arg);
 	}
       else
-	fn (data);
-      /* Access to "children" is normally done inside a task_lock
-	 mutex region, but the only way this particular task.children
-	 can be set is if this thread's task work function (fn)
-	 creates children.  So since the setter is *this* thread, we
-	 need no barriers here when testing for non-NULL.  We can have
-	 task.children set by the current thread then changed by a
-	 child thread, but seeing a stale non-NULL value is not a
-	 problem.  Once past the task_lock acquisition, this thread
-	 will see the real value of task.children.  */
-      if (task.children != NULL)
+	gomp_task_call (thr, team, fn, data);
+      /* The children of TASK refer to it until they complete, so it can't
+	 go away before they do.  Only this thread creates children of
+	 TASK, so a stale count of more than one is not a problem; the
+	 acquire load is to see what the children wrote once they're all
+	 done.  */
+      if (__atomic_load_n (&task.refcount, MEMMODEL_ACQUIRE) != 1)
+	gomp_task_wait_children (thr, team, &task);
+      gomp_end_task ();
+      if (__builtin_expect (inline_node != NULL, 0))
 	{
-	  gomp_mutex_lock (&team->task_lock);
-	  gomp_clear_parent (task.children);
-	  gomp_mutex_unlock (&team->task_lock);
+	  size_t new_tasks = gomp_taskgraph_run_post (thr, team, inline_node);
+
+	  if (new_tasks != 0)
+	    gomp_team_barrier_wake (&team->barrier, new_tasks);
 	}
-      gomp_end_task ();
     }
   else
     {
@@ -217,10 +1071,10 @@ GOMP_task (void (*fn) (void *), void *data, void (*cpyfn) (void *, void *),
       bool do_wake;
       size_t depend_size = 0;
 
-      if (flags & 8)
+      if ((flags & GOMP_TASK_FLAG_DEPEND) && node == NULL)
 	depend_size = ((uintptr_t) depend[0]
 		       * sizeof (struct gomp_task_depend_entry));
-      task = gomp_malloc (sizeof (*task) + depend_size
+      task = gomp_slab_alloc (sizeof (*task) + depend_size
 			  + arg_size + arg_align - 1);
       arg = (char *) (((uintptr_t) (task + 1) + depend_size + arg_align - 1)
 		      & ~(uintptr_t) (arg_align - 1));
@@ -240,209 +1094,52 @@ GOMP_task (void (*fn) (void *), void *data, void (*cpyfn) (void *, void *),
       task->kind = GOMP_TASK_WAITING;
       task->fn = fn;
       task->fn_data = arg;
-      task->final_task = (flags & 2) >> 1;
-      gomp_mutex_lock (&team->task_lock);
+      task->final_task = (flags & GOMP_TASK_FLAG_FINAL) != 0;
+      task->untied = (flags & GOMP_TASK_FLAG_UNTIED)
+		     && gomp_untied_stacksize_var != 0;
+      task->priority = priority;
       /* If parallel or taskgroup has been cancelled, don't start new
 	 tasks.  */
       if (__builtin_expect ((gomp_team_barrier_cancelled (&team->barrier)
 			     || (taskgroup && taskgroup->cancelled))
-			    && !task->copy_ctors_done, 0))
+			    && !task->copy_ctors_done && node == NULL, 0))
 	{
-	  gomp_mutex_unlock (&team->task_lock);
 	  gomp_finish_task (task);
-	  free (task);
+	  gomp_slab_free (task);
 	  return;
 	}
-      if (taskgroup)
-	taskgroup->num_children++;
-      if (depend_size)
-	{
-	  size_t ndepend = (uintptr_t) depend[0];
-	  size_t nout = (uintptr_t) depend[1];
-	  size_t i;
-	  hash_entry_type ent;
+      /* Only this thread adds references to PARENT while it runs, and
+	 TASK isn't visible to other threads yet.  */
+      __atomic_add_fetch (&parent->refcount, 1, MEMMODEL_RELAXED);
 
-	  task->depend_count = ndepend;
-	  task->num_dependees = 0;
-	  if (parent->depend_hash == NULL)
-	    parent->depend_hash
-	      = htab_create (2 * ndepend > 12 ? 2 * ndepend : 12);
-	  for (i = 0; i < ndepend; i++)
-	    {
-	      task->depend[i].addr = depend[2 + i];
-	      task->depend[i].next = NULL;
-	      task->depend[i].prev = NULL;
-	      task->depend[i].task = task;
-	      task->depend[i].is_in = i >= nout;
-	      task->depend[i].redundant = false;
-
-	      hash_entry_type *slot
-		= htab_find_slot (&parent->depend_hash, &task->depend[i],
-				  INSERT);
-	      hash_entry_type out = NULL;
-	      if (*slot)
-		{
-		  /* If multiple depends on the same task are the
-		     same, all but the first one are redundant.
-		     As inout/out come first, if any of them is
-		     inout/out, it will win, which is the right
-		     semantics.  */
-		  if ((*slot)->task == task)
-		    {
-		      task->depend[i].redundant = true;
-		      continue;
-		    }
-		  for (ent = *slot; ent; ent = ent->next)
-		    {
-		      /* depend(in:...) doesn't depend on earlier
-			 depend(in:...).  */
-		      if (i >= nout && ent->is_in)
-			continue;
-
-		      if (!ent->is_in)
-			out = ent;
-
-		      struct gomp_task *tsk = ent->task;
-		      if (tsk->dependers == NULL)
-			{
-			  tsk->dependers
-			    = gomp_malloc (sizeof (struct gomp_dependers_vec)
-					   + 6 * sizeof (struct gomp_task *));
-			  tsk->dependers->n_elem = 1;
-			  tsk->dependers->allocated = 6;
-			  tsk->dependers->elem[0] = task;
-			  task->num_dependees++;
-			  continue;
-			}
-		      /* We already have some other dependency on tsk
-			 from earlier depend clause.  */
-		      else if (tsk->dependers->n_elem
-			       && (tsk->dependers->elem[tsk->dependers->n_elem
-							- 1]
-				   == task))
-			continue;
-		      else if (tsk->dependers->n_elem
-			       == tsk->dependers->allocated)
-			{
-			  tsk->dependers->allocated
-			    = tsk->dependers->allocated * 2 + 2;
-			  tsk->dependers
-			    = gomp_realloc (tsk->dependers,
-					    sizeof (struct gomp_dependers_vec)
-					    + (tsk->dependers->allocated
-					       * sizeof (struct gomp_task *)));
-			}
-		      tsk->dependers->elem[tsk->dependers->n_elem++] = task;
-		      task->num_dependees++;
-		    }
-		  task->depend[i].next = *slot;
-		  (*slot)->prev = &task->depend[i];
-		}
-	      *slot = &task->depend[i];
-
-	      /* There is no need to store more than one depend({,in}out:)
-		 task per address in the hash table chain, because each out
-		 depends on all earlier outs, thus it is enough to record
-		 just the last depend({,in}out:).  For depend(in:), we need
-		 to keep all of the previous ones not terminated yet, because
-		 a later depend({,in}out:) might need to depend on all of
-		 them.  So, if the new task's clause is depend({,in}out:),
-		 we know there is at most one other depend({,in}out:) clause
-		 in the list (out) and to maintain the invariant we now
-		 need to remove it from the list.  */
-	      if (!task->depend[i].is_in && out)
-		{
-		  if (out->next)
-		    out->next->prev = out->prev;
-		  out->prev->next = out->next;
-		  out->redundant = true;
-		}
-	    }
-	  if (task->num_dependees)
-	    {
-	      gomp_mutex_unlock (&team->task_lock);
-	      return;
-	    }
-	}
-      if (parent->children)
-	{
-	  task->next_child = parent->children;
-	  task->prev_child = parent->children->prev_child;
-	  task->next_child->prev_child = task;
-	  task->prev_child->next_child = task;
-	}
-      else
-	{
-	  task->next_child = task;
-	  task->prev_child = task;
-	}
-      parent->children = task;
       if (taskgroup)
 	{
-	  if (taskgroup->children)
-	    {
-	      task->next_taskgroup = taskgroup->children;
-	      task->prev_taskgroup = taskgroup->children->prev_taskgroup;
-	      task->next_taskgroup->prev_taskgroup = task;
-	      task->prev_taskgroup->next_taskgroup = task;
-	    }
-	  else
-	    {
-	      task->next_taskgroup = task;
-	      task->prev_taskgroup = task;
-	    }
-	  taskgroup->children = task;
-	}
-      if (team->task_queue)
-	{
-	  task->next_queue = team->task_queue;
-	  task->prev_queue = team->task_queue->prev_queue;
-	  task->next_queue->prev_queue = task;
-	  task->prev_queue->next_queue = task;
+	  gomp_mutex_lock (&team->task_lock);
+	  taskgroup->num_children++;
+	  gomp_mutex_unlock (&team->task_lock);
 	}
-      else
+      if (node != NULL)
 	{
-	  task->next_queue = task;
-	  task->prev_queue = task;
-	  team->task_queue = task;
+	  /* Publish TASK to the predecessors, the last of which to
+	     complete queues it.  */
+	  task->taskgraph_node = node;
+	  node->task = task;
+	  if (__atomic_sub_fetch (&node->pending, 1, MEMMODEL_ACQ_REL) != 0)
+	    return;
 	}
-      ++team->task_count;
-      ++team->task_queued_count;
-      gomp_team_barrier_set_task_pending (&team->barrier);
+      else if (depend_size && gomp_task_add_depend (task, parent, depend))
+	return;
+      __atomic_add_fetch (&team->task_count, 1, MEMMODEL_RELAXED);
+      gomp_task_enqueue (thr, team, task, false);
       do_wake = team->task_running_count + !parent->in_tied_task
 		< team->nthreads;
-      gomp_mutex_unlock (&team->task_lock);
       if (do_wake)
 	gomp_team_barrier_wake (&team->barrier, 1);
     }
 }
 
-static inline bool
-gomp_task_run_pre (struct gomp_task *child_task, struct gomp_task *parent,
-		   struct gomp_taskgroup *taskgroup, struct gomp_team *team)
-{
-  if (parent && parent->children == child_task)
-    parent->children = child_task->next_child;
-  if (taskgroup && taskgroup->children == child_task)
-    taskgroup->children = child_task->next_taskgroup;
-  child_task->prev_queue->next_queue = child_task->next_queue;
-  child_task->next_queue->prev_queue = child_task->prev_queue;
-  if (team->task_queue == child_task)
-    {
-      if (child_task->next_queue != child_task)
-	team->task_queue = child_task->next_queue;
-      else
-	team->task_queue = NULL;
-    }
-  child_task->kind = GOMP_TASK_TIED;
-  if (--team->task_queued_count == 0)
-    gomp_team_barrier_clear_task_pending (&team->barrier);
-  if ((gomp_team_barrier_cancelled (&team->barrier)
-       || (taskgroup && taskgroup->cancelled))
-      && !child_task->copy_ctors_done)
-    return true;
-  return false;
-}
+/* Remove the entries of CHILD_TASK, which has completed, from the
+   dependency table of its parent.  */
 
 static void
 gomp_task_run_post_handle_depend_hash (struct gomp_task *child_task)
@@ -451,150 +1148,143 @@ gomp_task_run_post_handle_depend_hash (struct gomp_task *child_task)
   size_t i;
 
   for (i = 0; i < child_task->depend_count; i++)
-    if (!child_task->depend[i].redundant)
-      {
-	if (child_task->depend[i].next)
-	  child_task->depend[i].next->prev = child_task->depend[i].prev;
-	if (child_task->depend[i].prev)
-	  child_task->depend[i].prev->next = child_task->depend[i].next;
-	else
-	  {
-	    hash_entry_type *slot
-	      = htab_find_slot (&parent->depend_hash, &child_task->depend[i],
-				NO_INSERT);
-	    if (*slot != &child_task->depend[i])
-	      abort ();
-	    if (child_task->depend[i].next)
-	      *slot = child_task->depend[i].next;
-	    else
-	      htab_clear_slot (parent->depend_hash, slot);
-	  }
-      }
-}
-
-static size_t
-gomp_task_run_post_handle_dependers (struct gomp_task *child_task,
-				     struct gomp_team *team)
-{
-  struct gomp_task *parent = child_task->parent;
-  size_t i, count = child_task->dependers->n_elem, ret = 0;
-  for (i = 0; i < count; i++)
     {
-      struct gomp_task *task = child_task->dependers->elem[i];
-      if (--task->num_dependees != 0)
-	continue;
+      struct gomp_task_depend_entry *ent = &child_task->depend[i];
+      struct gomp_depend_shard *shard
+	= gomp_task_depend_shard (parent, ent->addr);
 
-      struct gomp_taskgroup *taskgroup = task->taskgroup;
-      if (parent)
+      /* A later out for the same address may have removed ENT from the
+	 table, which it does under the same shard lock.  */
+      gomp_mutex_lock (&shard->lock);
+      if (!ent->redundant)
 	{
-	  if (parent->children)
-	    {
-	      task->next_child = parent->children;
-	      task->prev_child = parent->children->prev_child;
-	      task->next_child->prev_child = task;
-	      task->prev_child->next_child = task;
-	    }
+	  if (ent->next)
+	    ent->next->prev = ent->prev;
+	  if (ent->prev)
+	    ent->prev->next = ent->next;
 	  else
 	    {
-	      task->next_child = task;
-	      task->prev_child = task;
-	    }
-	  parent->children = task;
-	  if (parent->in_taskwait)
-	    {
-	      parent->in_taskwait = false;
-	      gomp_sem_post (&parent->taskwait_sem);
-	    }
-	}
-      if (taskgroup)
-	{
-	  if (taskgroup->children)
-	    {
-	      task->next_taskgroup = taskgroup->children;
-	      task->prev_taskgroup = taskgroup->children->prev_taskgroup;
-	      task->next_taskgroup->prev_taskgroup = task;
-	      task->prev_taskgroup->next_taskgroup = task;
-	    }
-	  else
-	    {
-	      task->next_taskgroup = task;
-	      task->prev_taskgroup = task;
-	    }
-	  taskgroup->children = task;
-	  if (taskgroup->in_taskgroup_wait)
-	    {
-	      taskgroup->in_taskgroup_wait = false;
-	      gomp_sem_post (&taskgroup->taskgroup_sem);
+	      hash_entry_type *slot
+		= htab_find_slot (&shard->hash, ent, NO_INSERT);
+	      if (*slot != ent)
+		abort ();
+	      if (ent->next)
+		*slot = ent->next;
+	      else
+		htab_clear_slot (shard->hash, slot);
 	    }
 	}
-      if (team->task_queue)
-	{
-	  task->next_queue = team->task_queue;
-	  task->prev_queue = team->task_queue->prev_queue;
-	  task->next_queue->prev_queue = task;
-	  task->prev_queue->next_queue = task;
-	}
-      else
+      gomp_mutex_unlock (&shard->lock);
+    }
+}
+
+/* Queue TASK, whose last dependency has been satisfied by a sibling THR
+   has just completed, and wake its parent or taskgroup owner if they wait
+   for their children.  The sibling still holds its reference to the
+   parent, but the taskgroup may go away as soon as TASK is done, which
+   the task lock prevents.  */
+
+static void
+gomp_task_release (struct gomp_thread *thr, struct gomp_team *team,
+		   struct gomp_task *task)
+{
+  struct gomp_taskgroup *taskgroup = task->taskgroup;
+
+  __atomic_add_fetch (&team->task_count, 1, MEMMODEL_RELAXED);
+  if (taskgroup)
+    {
+      gomp_mutex_lock (&team->task_lock);
+      gomp_task_enqueue (thr, team, task, true);
+      if (taskgroup->in_taskgroup_wait)
 	{
-	  task->next_queue = task;
-	  task->prev_queue = task;
-	  team->task_queue = task;
+	  taskgroup->in_taskgroup_wait = false;
+	  gomp_sem_post (&taskgroup->taskgroup_sem);
 	}
-      ++team->task_count;
-      ++team->task_queued_count;
+      gomp_mutex_unlock (&team->task_lock);
+    }
+  else
+    gomp_task_enqueue (thr, team, task, false);
+  gomp_task_wake (task->parent);
+}
+
+/* Release the tasks in DEPENDERS, which waited for a task THR has just
+   completed, and queue those that waited for nothing else.  Returns the
+   number of tasks queued.  */
+
+static size_t
+gomp_task_run_post_handle_dependers (struct gomp_thread *thr,
+				     struct gomp_dependers_vec *dependers,
+				     struct gomp_team *team)
+{
+  size_t i, count = dependers->n_elem, ret = 0;
+  for (i = 0; i < count; i++)
+    {
+      uintptr_t elem = (uintptr_t) dependers->elem[i];
+      struct gomp_task *task
+	= (struct gomp_task *) (elem & ~GOMP_DEPENDER_WRITER);
+
+      /* Released by the decrement below if it is the last one.  */
+      if (elem & GOMP_DEPENDER_WRITER)
+	__atomic_store_n (&task->home, thr->ts.team_id + 1,
+			  MEMMODEL_RELAXED);
+      if (__atomic_sub_fetch (&task->num_dependees, 1, MEMMODEL_ACQ_REL) != 0)
+	continue;
+
+      gomp_task_release (thr, team, task);
       ++ret;
     }
-  free (child_task->dependers);
-  child_task->dependers = NULL;
-  if (ret > 1)
-    gomp_team_barrier_set_task_pending (&team->barrier);
+  gomp_slab_free (dependers);
   return ret;
 }
 
 static inline size_t
-gomp_task_run_post_handle_depend (struct gomp_task *child_task,
+gomp_task_run_post_handle_depend (struct gomp_thread *thr,
+				  struct gomp_task *child_task,
 				  struct gomp_team *team)
 {
+  struct gomp_dependers_vec *dependers;
+
   if (child_task->depend_count == 0)
     return 0;
 
-  /* If parent is gone already, the hash table is freed and nothing
-     will use the hash table anymore, no need to remove anything from it.  */
-  if (child_task->parent != NULL)
-    gomp_task_run_post_handle_depend_hash (child_task);
+  /* From now on, new siblings don't wait for CHILD_TASK, so its list of
+     dependers can't grow anymore.  */
+  gomp_mutex_lock (&child_task->depend_lock);
+  child_task->depend_done = true;
+  dependers = child_task->dependers;
+  child_task->dependers = NULL;
+  gomp_mutex_unlock (&child_task->depend_lock);
 
-  if (child_task->dependers == NULL)
+  gomp_task_run_post_handle_depend_hash (child_task);
+
+  if (dependers == NULL)
     return 0;
 
-  return gomp_task_run_post_handle_dependers (child_task, team);
+  return gomp_task_run_post_handle_dependers (thr, dependers, team);
 }
 
-static inline void
-gomp_task_run_post_remove_parent (struct gomp_task *child_task)
+/* Release the successors of NODE, whose task THR has just completed.
+   Returns the number of tasks queued.  */
+
+static size_t
+gomp_taskgraph_run_post (struct gomp_thread *thr, struct gomp_team *team,
+			 struct gomp_taskgraph_node *node)
 {
-  struct gomp_task *parent = child_task->parent;
-  if (parent == NULL)
-    return;
-  child_task->prev_child->next_child = child_task->next_child;
-  child_task->next_child->prev_child = child_task->prev_child;
-  if (parent->children != child_task)
-    return;
-  if (child_task->next_child != child_task)
-    parent->children = child_task->next_child;
-  else
+  struct gomp_taskgraph *graph = node->graph;
+  unsigned i;
+  size_t ret = 0;
+
+  for (i = 0; i < node->nsuccs; i++)
     {
-      /* We access task->children in GOMP_taskwait
-	 outside of the task lock mutex region, so
-	 need a release barrier here to ensure memory
-	 written by child_task->fn above is flushed
-	 before the NULL is written.  */
-      __atomic_store_n (&parent->children, NULL, MEMMODEL_RELEASE);
-      if (parent->in_taskwait)
-	{
-	  parent->in_taskwait = false;
-	  gomp_sem_post (&parent->taskwait_sem);
-	}
+      struct gomp_taskgraph_node *succ
+	= &graph->nodes[graph->succs[node->first_succ + i]];
+      if (__atomic_sub_fetch (&succ->pending, 1, MEMMODEL_ACQ_REL) != 0)
+	continue;
+
+      gomp_task_release (thr, team, succ->task);
+      ++ret;
     }
+  return ret;
 }
 
 static inline void
@@ -603,32 +1293,129 @@ gomp_task_run_post_remove_taskgroup (struct gomp_task *child_task)
   struct gomp_taskgroup *taskgroup = child_task->taskgroup;
   if (taskgroup == NULL)
     return;
-  child_task->prev_taskgroup->next_taskgroup = child_task->next_taskgroup;
-  child_task->next_taskgroup->prev_taskgroup = child_task->prev_taskgroup;
   if (taskgroup->num_children > 1)
     --taskgroup->num_children;
   else
     {
-      /* We access taskgroup->num_children in GOMP_taskgroup_end
-	 outside of the task lock mutex region, so
-	 need a release barrier here to ensure memory
-	 written by child_task->fn above is flushed
-	 before the NULL is written.  */
+      /* GOMP_taskgroup_end reads taskgroup->num_children outside of the
+	 task lock mutex region and frees the taskgroup once it sees 0,
+	 so unless its owner sleeps on the semaphore this must be our last
+	 access to it.  The release barrier ensures memory written by
+	 child_task->fn is flushed before the 0 is written.  */
+      bool wake = taskgroup->in_taskgroup_wait;
+      taskgroup->in_taskgroup_wait = false;
       __atomic_store_n (&taskgroup->num_children, 0, MEMMODEL_RELEASE);
+      if (wake)
+	gomp_sem_post (&taskgroup->taskgroup_sem);
     }
-  if (taskgroup->children != child_task)
-    return;
-  if (child_task->next_taskgroup != child_task)
-    taskgroup->children = child_task->next_taskgroup;
+}
+
+/* The user-level context of an untied task, followed by its stack.  */
+
+struct gomp_task_context
+{
+  gomp_context_t ctx;
+  /* Where the thread currently running the task is to resume when the
+     task completes or is suspended.  */
+  gomp_context_t *ret;
+  bool done;
+};
+
+static void
+gomp_task_context_start (void *data)
+{
+  struct gomp_task *task = data;
+  struct gomp_task_context *c = task->context;
+
+  /* The task may have moved to another thread by now, so this must not
+     look at any thread-local data.  */
+  task->fn (task->fn_data);
+  c->done = true;
+  gomp_context_switch (&c->ctx, c->ret);
+}
+
+/* Run or resume TASK, an untied task, on its own stack.  Returns false if
+   it has been suspended at a taskyield rather than completed.  */
+
+static bool
+gomp_task_run_untied (struct gomp_task *task)
+{
+  struct gomp_task_context *c = task->context;
+  gomp_context_t self;
+
+  if (c == NULL)
+    {
+      c = gomp_malloc (sizeof (*c) + gomp_untied_stacksize_var);
+      c->done = false;
+      task->context = c;
+      gomp_context_init (&c->ctx, c + 1, gomp_untied_stacksize_var,
+			 gomp_task_context_start, task);
+    }
+  c->ret = &self;
+  gomp_context_switch (&self, &c->ctx);
+  if (!c->done)
+    return false;
+  free (c);
+  task->context = NULL;
+  return true;
+}
+
+/* Run CHILD_TASK, just taken off a queue, on THR, unless its parallel or
+   taskgroup has been cancelled.  Returns false if CHILD_TASK has been
+   suspended rather than completed, in which case it has been queued again
+   for any thread to resume.  */
+
+static inline bool
+gomp_task_run (struct gomp_thread *thr, struct gomp_team *team,
+	       struct gomp_task *child_task)
+{
+  struct gomp_task *task = thr->task;
+  struct gomp_taskgroup *taskgroup = child_task->taskgroup;
+  bool done = true;
+
+  child_task->kind = GOMP_TASK_TIED;
+  if (__builtin_expect ((gomp_team_barrier_cancelled (&team->barrier)
+			 || (taskgroup && taskgroup->cancelled))
+			&& !child_task->copy_ctors_done
+			&& child_task->context == NULL, 0))
+    return true;
+  thr->task = child_task;
+  if (__builtin_expect (child_task->untied, 0))
+    done = gomp_task_run_untied (child_task);
   else
+    gomp_task_call (thr, team, child_task->fn, child_task->fn_data);
+  thr->task = task;
+  if (!done)
     {
-      taskgroup->children = NULL;
-      if (taskgroup->in_taskgroup_wait)
-	{
-	  taskgroup->in_taskgroup_wait = false;
-	  gomp_sem_post (&taskgroup->taskgroup_sem);
-	}
+      thr->task_suspended = child_task;
+      gomp_task_enqueue (thr, team, child_task, false);
+    }
+  return done;
+}
+
+/* Do the bookkeeping for CHILD_TASK, which has just been run by THR.
+   Returns the number of tasks that became ready because of it.  */
+
+static size_t
+gomp_task_run_post (struct gomp_thread *thr, struct gomp_team *team,
+		    struct gomp_task *child_task)
+{
+  size_t new_tasks;
+
+  if (child_task->taskgraph_node)
+    new_tasks = gomp_taskgraph_run_post (thr, team,
+					 child_task->taskgraph_node);
+  else
+    new_tasks = gomp_task_run_post_handle_depend (thr, child_task, team);
+  if (child_task->taskgroup)
+    {
+      gomp_mutex_lock (&team->task_lock);
+      gomp_task_run_post_remove_taskgroup (child_task);
+      gomp_mutex_unlock (&team->task_lock);
     }
+  gomp_task_unref (child_task->parent);
+  gomp_task_unref (child_task);
+  return new_tasks;
 }
 
 void
@@ -636,14 +1423,12 @@ gomp_barrier_handle_tasks (gomp_barrier_state_t state)
 {
   struct gomp_thread *thr = gomp_thread ();
   struct gomp_team *team = thr->ts.team;
-  struct gomp_task *task = thr->task;
-  struct gomp_task *child_task = NULL;
-  struct gomp_task *to_free = NULL;
-  int do_wake = 0;
+  struct gomp_task *child_task;
+  int do_wake;
 
-  gomp_mutex_lock (&team->task_lock);
   if (gomp_barrier_last_thread (state))
     {
+      gomp_mutex_lock (&team->task_lock);
       if (team->task_count == 0)
 	{
 	  gomp_team_barrier_done (&team->barrier, state);
@@ -652,76 +1437,118 @@ gomp_barrier_handle_tasks (gomp_barrier_state_t state)
 	  return;
 	}
       gomp_team_barrier_set_waiting_for_tasks (&team->barrier);
+      gomp_mutex_unlock (&team->task_lock);
     }
 
   while (1)
     {
-      bool cancelled = false;
-      if (team->task_queue != NULL)
-	{
-	  child_task = team->task_queue;
-	  cancelled = gomp_task_run_pre (child_task, child_task->parent,
-					 child_task->taskgroup, team);
-	  if (__builtin_expect (cancelled, 0))
-	    {
-	      if (to_free)
-		{
-		  gomp_finish_task (to_free);
-		  free (to_free);
-		  to_free = NULL;
-		}
-	      goto finish_cancelled;
-	    }
-	  team->task_running_count++;
-	  child_task->in_tied_task = true;
-	}
-      gomp_mutex_unlock (&team->task_lock);
-      if (do_wake)
+      size_t new_tasks;
+
+      child_task = gomp_task_take (thr, team, NULL);
+      if (child_task == NULL)
 	{
-	  gomp_team_barrier_wake (&team->barrier, do_wake);
-	  do_wake = 0;
+	  if (gomp_task_clear_pending (team))
+	    continue;
+	  /* Tell the adaptive cutoff that tasks are too scarce.  */
+	  if (__atomic_load_n (&team->task_count, MEMMODEL_RELAXED) != 0
+	      && !__atomic_load_n (&team->task_starved, MEMMODEL_RELAXED))
+	    __atomic_store_n (&team->task_starved, 1, MEMMODEL_RELAXED);
+	  return;
 	}
-      if (to_free)
+      __atomic_add_fetch (&team->task_running_count, 1, MEMMODEL_RELAXED);
+      child_task->in_tied_task = true;
+      if (!gomp_task_run (thr, team, child_task))
 	{
-	  gomp_finish_task (to_free);
-	  free (to_free);
-	  to_free = NULL;
+	  __atomic_sub_fetch (&team->task_running_count, 1, MEMMODEL_RELAXED);
+	  continue;
 	}
-      if (child_task)
+      new_tasks = gomp_task_run_post (thr, team, child_task);
+      __atomic_sub_fetch (&team->task_running_count, 1, MEMMODEL_RELAXED);
+      if (new_tasks > 1)
 	{
-	  thr->task = child_task;
-	  child_task->fn (child_task->fn_data);
-	  thr->task = task;
+	  do_wake = team->nthreads - team->task_running_count;
+	  if (do_wake > new_tasks)
+	    do_wake = new_tasks;
+	  if (do_wake > 0)
+	    gomp_team_barrier_wake (&team->barrier, do_wake);
 	}
-      else
-	return;
-      gomp_mutex_lock (&team->task_lock);
-      if (child_task)
+      if (__atomic_sub_fetch (&team->task_count, 1, MEMMODEL_ACQ_REL) == 0)
 	{
-	 finish_cancelled:;
-	  size_t new_tasks
-	    = gomp_task_run_post_handle_depend (child_task, team);
-	  gomp_task_run_post_remove_parent (child_task);
-	  gomp_clear_parent (child_task->children);
-	  gomp_task_run_post_remove_taskgroup (child_task);
-	  to_free = child_task;
-	  child_task = NULL;
-	  if (!cancelled)
-	    team->task_running_count--;
-	  if (new_tasks > 1)
-	    {
-	      do_wake = team->nthreads - team->task_running_count;
-	      if (do_wake > new_tasks)
-		do_wake = new_tasks;
-	    }
-	  if (--team->task_count == 0
+	  gomp_mutex_lock (&team->task_lock);
+	  if (team->task_count == 0
 	      && gomp_team_barrier_waiting_for_tasks (&team->barrier))
 	    {
 	      gomp_team_barrier_done (&team->barrier, state);
 	      gomp_mutex_unlock (&team->task_lock);
 	      gomp_team_barrier_wake (&team->barrier, 0);
-	      gomp_mutex_lock (&team->task_lock);
+	      return;
+	    }
+	  gomp_mutex_unlock (&team->task_lock);
+	}
+    }
+}
+
+/* Run ready tasks on THR until all children of TASK have completed,
+   sleeping when there is nothing to run.  Besides the children of TASK,
+   which may be sitting in some other thread's deque, only untied tasks
+   may be picked: TASK stays tied to THR, so a tied task that isn't its
+   descendant might wait for TASK, e.g. for a lock it holds.  */
+
+static void
+gomp_task_wait_children (struct gomp_thread *thr, struct gomp_team *team,
+			 struct gomp_task *task)
+{
+  struct gomp_task *child_task;
+  unsigned int ref;
+  int do_wake;
+
+  while ((ref = __atomic_load_n (&task->refcount, MEMMODEL_ACQUIRE)) != 1)
+    {
+      size_t new_tasks;
+
+      child_task = gomp_task_take (thr, team, task);
+      if (child_task == NULL)
+	{
+	  /* All remaining children are running in other threads or waiting
+	     for their dependencies.  Sleep until the last of them
+	     completes, or one of them becomes ready.  */
+	  if (!__atomic_compare_exchange_n (&task->refcount, &ref,
+					    ref | GOMP_TASK_REF_WAITING, false,
+					    MEMMODEL_SEQ_CST, MEMMODEL_ACQUIRE))
+	    continue;
+	  /* A child released after gomp_task_take looked may have been
+	     queued before the flag was set, see gomp_task_wake.  So look
+	     once more, and if there is one, take the flag back, unless
+	     somebody else cleared it first and so owes us a post.  */
+	  child_task = gomp_task_take (thr, team, task);
+	  if (child_task == NULL)
+	    {
+	      gomp_sem_wait (&task->taskwait_sem);
+	      continue;
 	    }
+	  ref |= GOMP_TASK_REF_WAITING;
+	  while ((ref & GOMP_TASK_REF_WAITING)
+		 && !__atomic_compare_exchange_n (&task->refcount, &ref,
+						  ref & ~GOMP_TASK_REF_WAITING,
+						  false, MEMMODEL_ACQ_REL,
+						  MEMMODEL_ACQUIRE))
+	    ;
+	  if ((ref & GOMP_TASK_REF_WAITING) == 0)
+	    gomp_sem_wait (&task->taskwait_sem);
+	}
+
+      if (!gomp_task_run (thr, team, child_task))
+	continue;
+      new_tasks = gomp_task_run_post (thr, team, child_task);
+      __atomic_sub_fetch (&team->task_count, 1, MEMMODEL_RELEASE);
+      if (new_tasks > 1)
+	{
+	  do_wake = team->nthreads - team->task_running_count
+		    - !task->in_tied_task;
+	  if (do_wake > new_tasks)
+	    do_wake = new_tasks;
+	  if (do_wake > 0)
+	    gomp_team_barrier_wake (&team->barrier, do_wake);
 	}
     }
 }
@@ -734,112 +1561,62 @@ GOMP_taskwait (void)
   struct gomp_thread *thr = gomp_thread ();
   struct gomp_team *team = thr->ts.team;
   struct gomp_task *task = thr->task;
-  struct gomp_task *child_task = NULL;
-  struct gomp_task *to_free = NULL;
-  int do_wake = 0;
 
-  /* The acquire barrier on load of task->children here synchronizes
-     with the write of a NULL in gomp_task_run_post_remove_parent.  It is
-     not necessary that we synchronize with other non-NULL writes at
-     this point, but we must ensure that all writes to memory by a
-     child thread task work function are seen before we exit from
-     GOMP_taskwait.  */
+  /* The acquire barrier on load of task->refcount here synchronizes
+     with the release of the last child's reference in gomp_task_unref.
+     We must ensure that all writes to memory by a child thread task work
+     function are seen before we exit from GOMP_taskwait.  */
   if (task == NULL
-      || __atomic_load_n (&task->children, MEMMODEL_ACQUIRE) == NULL)
+      || __atomic_load_n (&task->refcount, MEMMODEL_ACQUIRE) == 1)
     return;
 
-  gomp_mutex_lock (&team->task_lock);
-  while (1)
-    {
-      bool cancelled = false;
-      if (task->children == NULL)
-	{
-	  gomp_mutex_unlock (&team->task_lock);
-	  if (to_free)
-	    {
-	      gomp_finish_task (to_free);
-	      free (to_free);
-	    }
-	  return;
-	}
-      if (task->children->kind == GOMP_TASK_WAITING)
-	{
-	  child_task = task->children;
-	  cancelled
-	    = gomp_task_run_pre (child_task, task, child_task->taskgroup,
-				 team);
-	  if (__builtin_expect (cancelled, 0))
-	    {
-	      if (to_free)
-		{
-		  gomp_finish_task (to_free);
-		  free (to_free);
-		  to_free = NULL;
-		}
-	      goto finish_cancelled;
-	    }
-	}
-      else
-	/* All tasks we are waiting for are already running
-	   in other threads.  Wait for them.  */
-	task->in_taskwait = true;
-      gomp_mutex_unlock (&team->task_lock);
-      if (do_wake)
-	{
-	  gomp_team_barrier_wake (&team->barrier, do_wake);
-	  do_wake = 0;
-	}
-      if (to_free)
-	{
-	  gomp_finish_task (to_free);
-	  free (to_free);
-	  to_free = NULL;
-	}
-      if (child_task)
-	{
-	  thr->task = child_task;
-	  child_task->fn (child_task->fn_data);
-	  thr->task = task;
-	}
-      else
-	gomp_sem_wait (&task->taskwait_sem);
-      gomp_mutex_lock (&team->task_lock);
-      if (child_task)
-	{
-	 finish_cancelled:;
-	  size_t new_tasks
-	    = gomp_task_run_post_handle_depend (child_task, team);
-	  child_task->prev_child->next_child = child_task->next_child;
-	  child_task->next_child->prev_child = child_task->prev_child;
-	  if (task->children == child_task)
-	    {
-	      if (child_task->next_child != child_task)
-		task->children = child_task->next_child;
-	      else
-		task->children = NULL;
-	    }
-	  gomp_clear_parent (child_task->children);
-	  gomp_task_run_post_remove_taskgroup (child_task);
-	  to_free = child_task;
-	  child_task = NULL;
-	  team->task_count--;
-	  if (new_tasks > 1)
-	    {
-	      do_wake = team->nthreads - team->task_running_count
-			- !task->in_tied_task;
-	      if (do_wake > new_tasks)
-		do_wake = new_tasks;
-	    }
-	}
-    }
+  gomp_task_wait_children (thr, team, task);
 }
 
-/* Called when encountering a taskyield directive.  */
+/* Called when encountering a taskyield directive.  An untied task with a
+   context of its own is suspended and queued again if there are other
+   tasks to run, and resumed later by whichever thread takes it.  Any
+   other task runs one ready task in its place, if there is one that the
+   tied task scheduling constraints allow: an untied task, or a child of
+   the current task, see gomp_task_allowed.  */
 
 void
 GOMP_taskyield (void)
 {
-  /* Nothing at the moment.  */
+  struct gomp_thread *thr = gomp_thread ();
+  struct gomp_team *team = thr->ts.team;
+  struct gomp_task *task = thr->task;
+  struct gomp_task *child_task;
+  size_t new_tasks;
+  int do_wake;
+
+  if (team == NULL
+      || __atomic_load_n (&team->task_queued_count, MEMMODEL_RELAXED) == 0)
+    return;
+
+  if (task->context != NULL)
+    {
+      /* This returns on whichever thread resumes the task.  */
+      gomp_context_switch (&task->context->ctx, task->context->ret);
+      return;
+    }
+
+  child_task = gomp_task_take (thr, team, task);
+  if (child_task == NULL)
+    return;
+  if (!gomp_task_run (thr, team, child_task))
+    return;
+  new_tasks = gomp_task_run_post (thr, team, child_task);
+  __atomic_sub_fetch (&team->task_count, 1, MEMMODEL_RELEASE);
+  if (new_tasks > 1)
+    {
+      do_wake = team->nthreads - team->task_running_count
+		- !task->in_tied_task;
+      if (do_wake > new_tasks)
+	do_wake = new_tasks;
+      if (do_wake > 0)
+	gomp_team_barrier_wake (&team->barrier, do_wake);
+    }
 }
 
 void
@@ -856,9 +1633,8 @@ GOMP_taskgroup_start (void)
      by the time GOMP_taskgroup_end is called.  */
   if (team == NULL)
     return;
-  taskgroup = gomp_malloc (sizeof (struct gomp_taskgroup));
+  taskgroup = gomp_slab_alloc (sizeof (struct gomp_taskgroup));
   taskgroup->prev = task->taskgroup;
-  taskgroup->children = NULL;
   taskgroup->in_taskgroup_wait = false;
   taskgroup->cancelled = false;
   taskgroup->num_children = 0;
@@ -873,9 +1649,8 @@ GOMP_taskgroup_end (void)
   struct gomp_team *team = thr->ts.team;
   struct gomp_task *task = thr->task;
   struct gomp_taskgroup *taskgroup;
-  struct gomp_task *child_task = NULL;
-  struct gomp_task *to_free = NULL;
-  int do_wake = 0;
+  struct gomp_task *child_task;
+  int do_wake;
 
   if (team == NULL)
     return;
@@ -887,106 +1662,306 @@ GOMP_taskgroup_end (void)
      this point, but we must ensure that all writes to memory by a
      child thread task work function are seen before we exit from
      GOMP_taskgroup_end.  */
-  if (__atomic_load_n (&taskgroup->num_children, MEMMODEL_ACQUIRE) == 0)
-    goto finish;
-
-  gomp_mutex_lock (&team->task_lock);
-  while (1)
+  while (__atomic_load_n (&taskgroup->num_children, MEMMODEL_ACQUIRE) != 0)
     {
-      bool cancelled = false;
-      if (taskgroup->children == NULL)
+      size_t new_tasks;
+
+      /* As in gomp_task_wait_children, only children of TASK and untied
+	 tasks may run here.  */
+      child_task = gomp_task_take (thr, team, task);
+      if (child_task == NULL)
 	{
-	  if (taskgroup->num_children)
-	    goto do_wait;
-	  gomp_mutex_unlock (&team->task_lock);
-	  if (to_free)
+	  bool woken;
+
+	  /* All tasks we are waiting for are already running in other
+	     threads, or waiting for their dependencies.  Wait for them.  */
+	  gomp_mutex_lock (&team->task_lock);
+	  if (taskgroup->num_children == 0)
 	    {
-	      gomp_finish_task (to_free);
-	      free (to_free);
+	      gomp_mutex_unlock (&team->task_lock);
+	      continue;
 	    }
-	  goto finish;
-	}
-      if (taskgroup->children->kind == GOMP_TASK_WAITING)
-	{
-	  child_task = taskgroup->children;
-	  cancelled
-	    = gomp_task_run_pre (child_task, child_task->parent, taskgroup,
-				 team);
-	  if (__builtin_expect (cancelled, 0))
+	  taskgroup->in_taskgroup_wait = true;
+	  gomp_mutex_unlock (&team->task_lock);
+	  /* Tasks of the taskgroup released by their dependencies are queued
+	     under the task lock before the flag is looked at, so any that
+	     was queued too early to see it is found here.  */
+	  child_task = gomp_task_take (thr, team, task);
+	  if (child_task == NULL)
 	    {
-	      if (to_free)
-		{
-		  gomp_finish_task (to_free);
-		  free (to_free);
-		  to_free = NULL;
-		}
-	      goto finish_cancelled;
+	      gomp_sem_wait (&taskgroup->taskgroup_sem);
+	      continue;
 	    }
+	  gomp_mutex_lock (&team->task_lock);
+	  woken = !taskgroup->in_taskgroup_wait;
+	  taskgroup->in_taskgroup_wait = false;
+	  gomp_mutex_unlock (&team->task_lock);
+	  if (woken)
+	    gomp_sem_wait (&taskgroup->taskgroup_sem);
 	}
-      else
-	{
-	 do_wait:
-	  /* All tasks we are waiting for are already running
-	     in other threads.  Wait for them.  */
-	  taskgroup->in_taskgroup_wait = true;
-	}
-      gomp_mutex_unlock (&team->task_lock);
-      if (do_wake)
-	{
-	  gomp_team_barrier_wake (&team->barrier, do_wake);
-	  do_wake = 0;
-	}
-      if (to_free)
-	{
-	  gomp_finish_task (to_free);
-	  free (to_free);
-	  to_free = NULL;
-	}
-      if (child_task)
+
+      if (!gomp_task_run (thr, team, child_task))
+	continue;
+      new_tasks = gomp_task_run_post (thr, team, child_task);
+      __atomic_sub_fetch (&team->task_count, 1, MEMMODEL_RELEASE);
+      if (new_tasks > 1)
 	{
-	  thr->task = child_task;
-	  child_task->fn (child_task->fn_data);
-	  thr->task = task;
+	  do_wake = team->nthreads - team->task_running_count
+		    - !task->in_tied_task;
+	  if (do_wake > new_tasks)
+	    do_wake = new_tasks;
+	  if (do_wake > 0)
+	    gomp_team_barrier_wake (&team->barrier, do_wake);
 	}
-      else
-	gomp_sem_wait (&taskgroup->taskgroup_sem);
-      gomp_mutex_lock (&team->task_lock);
-      if (child_task)
+    }
+
+  task->taskgroup = taskgroup->prev;
+  gomp_sem_destroy (&taskgroup->taskgroup_sem);
+  gomp_slab_free (taskgroup);
+}
+
+ialias (GOMP_taskgroup_start)
+ialias (GOMP_taskgroup_end)
+
+#define TYPE long
+#define UTYPE unsigned long
+#define TYPE_is_long 1
+#include "taskloop.c"
+#undef TYPE
+#undef UTYPE
+#undef TYPE_is_long
+
+#define TYPE unsigned long long
+#define UTYPE TYPE
+#define GOMP_taskloop GOMP_taskloop_ull
+#include "taskloop.c"
+#undef TYPE
+#undef UTYPE
+#undef GOMP_taskloop
+
+/* Dependency of node NODE of a task graph on ADDR, for
+   gomp_taskgraph_build.  */
+
+struct gomp_taskgraph_dep
+{
+  void *addr;
+  unsigned node;
+  bool is_in;
+};
+
+static int
+gomp_taskgraph_dep_cmp (const void *a, const void *b)
+{
+  const struct gomp_taskgraph_dep *x = a, *y = b;
+
+  if (x->addr != y->addr)
+    return (uintptr_t) x->addr < (uintptr_t) y->addr ? -1 : 1;
+  if (x->node != y->node)
+    return x->node < y->node ? -1 : 1;
+  return (int) x->is_in - (int) y->is_in;
+}
+
+static int
+gomp_taskgraph_edge_cmp (const void *a, const void *b)
+{
+  unsigned long long x = *(const unsigned long long *) a;
+  unsigned long long y = *(const unsigned long long *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* Work out the dependencies among the nodes of GRAPH, just recorded, from
+   their depend clauses, with the same rules gomp_task_add_depend applies
+   as tasks are created, and store them as the successors of each node.  */
+
+static void
+gomp_taskgraph_build (struct gomp_taskgraph *graph)
+{
+  struct gomp_taskgraph_dep *deps;
+  unsigned long long *edges;
+  unsigned *ins;
+  size_t ndeps = 0, nedges = 0, max_edges, nins, i, j, k;
+  unsigned last_out;
+
+  for (i = 0; i < graph->nnodes; i++)
+    ndeps += graph->nodes[i].ndepend;
+  if (ndeps == 0)
+    return;
+
+  deps = gomp_malloc (ndeps * sizeof (*deps));
+  for (i = 0, k = 0; i < graph->nnodes; i++)
+    for (j = 0; j < graph->nodes[i].ndepend; j++, k++)
+      {
+	deps[k].addr = graph->nodes[i].depend[j];
+	deps[k].node = i;
+	deps[k].is_in = j >= graph->nodes[i].nout;
+      }
+  qsort (deps, ndeps, sizeof (*deps), gomp_taskgraph_dep_cmp);
+
+  /* Each clause adds at most one edge per earlier clause on the same
+     address.  */
+  edges = gomp_malloc (ndeps * sizeof (*edges));
+  ins = gomp_malloc (ndeps * sizeof (*ins));
+  max_edges = ndeps;
+  for (i = 0; i < ndeps; i = j)
+    {
+      last_out = ~0U;
+      nins = 0;
+      for (j = i; j < ndeps && deps[j].addr == deps[i].addr; j++)
 	{
-	 finish_cancelled:;
-	  size_t new_tasks
-	    = gomp_task_run_post_handle_depend (child_task, team);
-	  child_task->prev_taskgroup->next_taskgroup
-	    = child_task->next_taskgroup;
-	  child_task->next_taskgroup->prev_taskgroup
-	    = child_task->prev_taskgroup;
-	  --taskgroup->num_children;
-	  if (taskgroup->children == child_task)
+	  unsigned node = deps[j].node;
+
+	  /* All but the first clause of a node on the same address are
+	     redundant, and an out clause sorts first.  */
+	  if (j > i && deps[j - 1].node == node)
+	    continue;
+	  if (nedges + nins + 1 > max_edges)
 	    {
-	      if (child_task->next_taskgroup != child_task)
-		taskgroup->children = child_task->next_taskgroup;
-	      else
-		taskgroup->children = NULL;
+	      max_edges = 2 * max_edges + nins + 1;
+	      edges = gomp_realloc (edges, max_edges * sizeof (*edges));
+	    }
+	  if (deps[j].is_in)
+	    {
+	      if (last_out != ~0U)
+		edges[nedges++] = ((unsigned long long) last_out << 32) | node;
+	      ins[nins++] = node;
 	    }
-	  gomp_task_run_post_remove_parent (child_task);
-	  gomp_clear_parent (child_task->children);
-	  to_free = child_task;
-	  child_task = NULL;
-	  team->task_count--;
-	  if (new_tasks > 1)
+	  else
 	    {
-	      do_wake = team->nthreads - team->task_running_count
-			- !task->in_tied_task;
-	      if (do_wake > new_tasks)
-		do_wake = new_tasks;
+	      /* The ins since the last out already wait for it.  */
+	      if (nins)
+		for (k = 0; k < nins; k++)
+		  edges[nedges++] = ((unsigned long long) ins[k] << 32) | node;
+	      else if (last_out != ~0U)
+		edges[nedges++] = ((unsigned long long) last_out << 32) | node;
+	      last_out = node;
+	      nins = 0;
 	    }
 	}
     }
+  free (ins);
+  free (deps);
 
- finish:
-  task->taskgroup = taskgroup->prev;
-  gomp_sem_destroy (&taskgroup->taskgroup_sem);
-  free (taskgroup);
+  /* Sorting the edges by predecessor groups the successors of each node,
+     and makes duplicates from several addresses adjacent.  */
+  qsort (edges, nedges, sizeof (*edges), gomp_taskgraph_edge_cmp);
+  graph->succs = gomp_malloc ((nedges ? nedges : 1) * sizeof (unsigned));
+  for (i = 0, k = 0; i < nedges; i++)
+    {
+      unsigned pred = edges[i] >> 32, succ = (unsigned) edges[i];
+
+      if (i > 0 && edges[i] == edges[i - 1])
+	continue;
+      if (graph->nodes[pred].nsuccs++ == 0)
+	graph->nodes[pred].first_succ = k;
+      graph->nodes[succ].npreds++;
+      graph->succs[k++] = succ;
+    }
+  free (edges);
+}
+
+/* Start the task graph ID in the current task, recording it if it hasn't
+   been yet, else replaying it.  The children of the current task are
+   waited for first, as replayed tasks don't look for dependencies on
+   tasks created before the graph.  */
+
+void
+omp_taskgraph_begin (unsigned id)
+{
+  struct gomp_thread *thr = gomp_thread ();
+  struct gomp_team *team = thr->ts.team;
+  struct gomp_task *task = thr->task;
+  struct gomp_taskgraph *graph;
+  unsigned i;
+
+  if (id >= GOMP_TASKGRAPH_MAX)
+    gomp_fatal ("omp_taskgraph_begin: task graph %u out of range", id);
+  /* Without a team, all tasks are run right away.  */
+  if (team == NULL)
+    return;
+  if (task->taskgraph != NULL)
+    gomp_fatal ("omp_taskgraph_begin: task graphs can't be nested");
+
+  gomp_mutex_lock (&gomp_taskgraph_lock);
+  graph = gomp_taskgraphs[id];
+  if (graph == NULL)
+    {
+      graph = gomp_malloc_cleared (sizeof (*graph));
+      gomp_taskgraphs[id] = graph;
+    }
+  if (graph->active)
+    {
+      gomp_mutex_unlock (&gomp_taskgraph_lock);
+      gomp_fatal ("omp_taskgraph_begin: task graph %u is already active",
+		  id);
+    }
+  graph->active = true;
+  gomp_mutex_unlock (&gomp_taskgraph_lock);
+  if (__atomic_load_n (&task->refcount, MEMMODEL_ACQUIRE) != 1)
+    gomp_task_wait_children (thr, team, task);
+  graph->next = 0;
+  if (graph->recorded)
+    for (i = 0; i < graph->nnodes; i++)
+      {
+	graph->nodes[i].pending = graph->nodes[i].npreds + 1;
+	graph->nodes[i].task = NULL;
+      }
+  task->taskgraph = graph;
+}
+
+/* End the task graph started by omp_taskgraph_begin in the current task,
+   waiting for all its tasks to complete, like taskwait.  */
+
+void
+omp_taskgraph_end (void)
+{
+  struct gomp_thread *thr = gomp_thread ();
+  struct gomp_team *team = thr->ts.team;
+  struct gomp_task *task = thr->task;
+  struct gomp_taskgraph *graph;
+
+  if (team == NULL)
+    return;
+  if (__atomic_load_n (&task->refcount, MEMMODEL_ACQUIRE) != 1)
+    gomp_task_wait_children (thr, team, task);
+
+  /* GRAPH is NULL if a task didn't match it, and it has been dropped.  */
+  graph = task->taskgraph;
+  if (graph == NULL)
+    return;
+  task->taskgraph = NULL;
+  if (!graph->recorded)
+    {
+      gomp_taskgraph_build (graph);
+      graph->recorded = true;
+    }
+  else if (graph->next != graph->nnodes)
+    gomp_taskgraph_clear (graph);
+  gomp_mutex_lock (&gomp_taskgraph_lock);
+  graph->active = false;
+  gomp_mutex_unlock (&gomp_taskgraph_lock);
+}
+
+/* Forget the task graph ID, so that it is recorded again the next time.
+   Must not be called while it is being recorded or replayed.  */
+
+void
+omp_taskgraph_reset (unsigned id)
+{
+  struct gomp_taskgraph *graph;
+
+  if (id >= GOMP_TASKGRAPH_MAX)
+    gomp_fatal ("omp_taskgraph_reset: task graph %u out of range", id);
+  gomp_mutex_lock (&gomp_taskgraph_lock);
+  graph = gomp_taskgraphs[id];
+  if (graph != NULL && graph->active)
+    {
+      gomp_mutex_unlock (&gomp_taskgraph_lock);
+      gomp_fatal ("omp_taskgraph_reset: task graph %u is active", id);
+    }
+  if (graph != NULL)
+    gomp_taskgraph_clear (graph);
+  gomp_mutex_unlock (&gomp_taskgraph_lock);
 }
 
 int
@@ -44,19 +44,166 @@ pthread_key_t gomp_tls_key;
 #endif
 
 
-/* This structure is used to communicate across pthread_create.  */
+/* This structure is used to communicate across pthread_create.  The
+   structures of all threads of a team are in an array ALL of NTHREADS
+   entries indexed by team_id, where CREATE marks the threads to be
+   created, see gomp_thread_create_children.  */
 
 struct gomp_thread_start_data
 {
   void (*fn) (void *);
   void *fn_data;
   struct gomp_team_state ts;
-  struct gomp_task *task;
   struct gomp_thread_pool *thread_pool;
+  /* The pool the thread docks in between teams.  It differs from
+     THREAD_POOL for the threads of nested teams.  */
+  struct gomp_thread_pool *dock_pool;
+  struct gomp_thread_start_data *all;
+  unsigned int nthreads;
   unsigned int place;
-  bool nested;
+  bool create;
 };
 
+/* Teams are launched along a tree of this fan-out, in which the children
+   of thread I are threads I * GOMP_LAUNCH_FANOUT + 1 on.  Both the setup
+   of the threads of the pool and the creation of new threads go down the
+   tree, each thread taking care of its children.  */
+#define GOMP_LAUNCH_FANOUT 4
+
+static void *gomp_thread_start (void *);
+static void gomp_init_task_deque (struct gomp_task_deque *);
+static void gomp_free_team_slot (struct gomp_thread *);
+static void gomp_free_nested_pools (struct gomp_thread *);
+
+/* Create the threads of DATA->all below thread DATA->ts.team_id in the
+   launch tree, or, for the master, the threads whose parent in the tree
+   isn't created itself.  */
+
+static void
+gomp_thread_create_children (struct gomp_thread_start_data *data)
+{
+  struct gomp_thread_start_data *all = data->all;
+  unsigned int id = data->ts.team_id, i, first, last;
+  pthread_attr_t thread_attr, *attr;
+
+  if (id == 0)
+    {
+      first = 1;
+      last = data->nthreads;
+    }
+  else
+    {
+      first = id * GOMP_LAUNCH_FANOUT + 1;
+      last = first + GOMP_LAUNCH_FANOUT;
+      if (first >= data->nthreads)
+	return;
+      if (last > data->nthreads)
+	last = data->nthreads;
+    }
+
+  attr = &gomp_thread_attr;
+  if (__builtin_expect (gomp_places_list != NULL, 0))
+    {
+      size_t stacksize;
+      pthread_attr_init (&thread_attr);
+      pthread_attr_setdetachstate (&thread_attr, PTHREAD_CREATE_DETACHED);
+      if (! pthread_attr_getstacksize (&gomp_thread_attr, &stacksize))
+	pthread_attr_setstacksize (&thread_attr, stacksize);
+      attr = &thread_attr;
+    }
+
+  for (i = first; i < last; i++)
+    {
+      pthread_t pt;
+      int err;
+
+      if (!all[i].create
+	  || (id == 0 && all[(i - 1) / GOMP_LAUNCH_FANOUT].create))
+	continue;
+      if (__builtin_expect (gomp_places_list != NULL, 0))
+	gomp_init_thread_affinity (attr, all[i].place - 1);
+      err = pthread_create (&pt, attr, gomp_thread_start, &all[i]);
+      if (err != 0)
+	gomp_fatal ("Thread creation failed: %s", strerror (err));
+    }
+
+  if (__builtin_expect (gomp_places_list != NULL, 0))
+    pthread_attr_destroy (&thread_attr);
+}
+
+/* Set up the children of thread ID in the launch tree of TEAM, drawn from
+   POOL, and let them out of the dock, whose current use ends with
+   generation TARGET.  The master starts at the top once the whole team
+   has docked, and every other thread continues with its own children
+   as it leaves the dock, so that the team is set up in parallel.  The
+   places of the threads have been set by the master already.  */
+
+static void
+gomp_team_launch (struct gomp_thread_pool *pool, struct gomp_team *team,
+		  unsigned int id, gomp_barrier_state_t target)
+{
+  unsigned int i, first, last;
+
+  /* Threads released by gomp_free_thread have no team.  */
+  if (team == NULL)
+    return;
+
+  first = id * GOMP_LAUNCH_FANOUT + 1;
+  last = first + GOMP_LAUNCH_FANOUT;
+  if (last > team->nthreads)
+    last = team->nthreads;
+  for (i = first; i < last; i++)
+    {
+      struct gomp_thread *nthr = pool->threads[i];
+
+      nthr->ts.team = team;
+      nthr->ts.work_share = &team->work_shares[0];
+      nthr->ts.work_share_seq = 0;
+      nthr->ts.team_id = i;
+      nthr->ts.level = team->prev_ts.level + 1;
+      nthr->ts.active_level = team->prev_ts.active_level + 1;
+      if (__builtin_expect (gomp_places_list == NULL, 1))
+	{
+	  nthr->ts.place_partition_off = team->prev_ts.place_partition_off;
+	  nthr->ts.place_partition_len = team->prev_ts.place_partition_len;
+	  nthr->place = 0;
+	}
+#ifdef HAVE_SYNC_BUILTINS
+      nthr->ts.single_count = 0;
+#endif
+      nthr->ts.static_trip = 0;
+      nthr->ts.taskmap_cursor = 0;
+      nthr->task = &nthr->team_slot->implicit_task;
+      gomp_init_task (nthr->task, team->launch_parent, &team->launch_icv);
+      nthr->fn = team->launch_fn;
+      nthr->data = team->launch_data;
+      team->ordered_release[i] = &nthr->release;
+      gomp_barrier_undock (&nthr->dock_go, target);
+    }
+}
+
+/* Let the threads the affinity code of gomp_team_start left over in
+   AFFINITY_THR, a list per place of PLACES, out of the dock, whose
+   current use ends with generation TARGET.  They leave the pool.  */
+
+static void
+gomp_undock_affinity_thr (struct gomp_thread **affinity_thr,
+			  unsigned int places, gomp_barrier_state_t target)
+{
+  unsigned int l;
+
+  for (l = 0; l < places; l++)
+    {
+      struct gomp_thread *nthr = affinity_thr[l], *next;
+
+      for (; nthr != NULL; nthr = next)
+	{
+	  next = (struct gomp_thread *) nthr->data;
+	  gomp_barrier_undock (&nthr->dock_go, target);
+	}
+    }
+}
+
 
 /* This function is a pthread_create entry point.  This contains the idle
    loop in which a thread waits to be called up to become part of a team.  */
@@ -75,6 +222,14 @@ gomp_thread_start (void *xdata)
 #else
   struct gomp_thread local_thr;
   thr = &local_thr;
+  memset (&thr->slab_cache, 0, sizeof (thr->slab_cache));
+  thr->dock_go = 0;
+  thr->barrier_spin_est = 0;
+  thr->mutex_spin_est = 0;
+  thr->team_barrier_spin_est = 0;
+  thr->nested_pools = NULL;
+  thr->nested_pools_size = 0;
+  thr->task_suspended = NULL;
   pthread_setspecific (gomp_tls_key, thr);
 #endif
   gomp_sem_init (&thr->release, 0);
@@ -84,95 +239,199 @@ gomp_thread_start (void *xdata)
   local_data = data->fn_data;
   thr->thread_pool = data->thread_pool;
   thr->ts = data->ts;
-  thr->task = data->task;
   thr->place = data->place;
 
-  thr->ts.team->ordered_release[thr->ts.team_id] = &thr->release;
+  /* Make the pool we dock in local. */
+  pool = data->dock_pool;
 
-  /* Make thread pool local. */
-  pool = thr->thread_pool;
+  gomp_thread_create_children (data);
+
+  /* The thread runs on its place already, so its team slot ends up on
+     the right NUMA node.  */
+  thr->team_slot = gomp_aligned_alloc (64, sizeof (struct gomp_team_slot));
+  gomp_init_task_deque (&thr->team_slot->deque);
 
-  if (data->nested)
+  /* The rest of the team state is set up by the parent of this thread
+     in the launch tree before it lets it out of the dock.  */
+  pool->threads[thr->ts.team_id] = thr;
+  pool->task_deques[thr->ts.team_id] = &thr->team_slot->deque;
+
+  gomp_barrier_wait_dock (&pool->threads_dock, &thr->dock_go);
+  while ((local_fn = thr->fn) != NULL)
     {
       struct gomp_team *team = thr->ts.team;
       struct gomp_task *task = thr->task;
 
-      gomp_barrier_wait (&team->barrier);
+      local_data = thr->data;
+      thr->fn = NULL;
+      gomp_team_launch (pool, team, thr->ts.team_id, thr->dock_go);
 
       local_fn (local_data);
       gomp_team_barrier_wait_final (&team->barrier);
       gomp_finish_task (task);
-      gomp_barrier_wait_last (&team->barrier);
+
+      gomp_barrier_wait_dock (&pool->threads_dock, &thr->dock_go);
     }
-  else
-    {
-      pool->threads[thr->ts.team_id] = thr;
 
-      gomp_barrier_wait (&pool->threads_dock);
-      do
-	{
-	  struct gomp_team *team = thr->ts.team;
-	  struct gomp_task *task = thr->task;
+  gomp_free_nested_pools (thr);
+  gomp_sem_destroy (&thr->release);
+  gomp_slab_release (thr);
+  thr->thread_pool = NULL;
+  thr->task = NULL;
+  gomp_free_team_slot (thr);
+  return NULL;
+}
 
-	  local_fn (local_data);
-	  gomp_team_barrier_wait_final (&team->barrier);
-	  gomp_finish_task (task);
 
-	  gomp_barrier_wait (&pool->threads_dock);
+/* Return the pool the teams THR starts draw their threads from, or NULL
+   if it hasn't got one yet.  */
 
-	  local_fn = thr->fn;
-	  local_data = thr->data;
-	  thr->fn = NULL;
+static struct gomp_thread_pool *
+gomp_team_pool (struct gomp_thread *thr)
+{
+  if (thr->ts.team == NULL)
+    return thr->thread_pool;
+  if (thr->ts.level - 1 < thr->nested_pools_size)
+    return thr->nested_pools[thr->ts.level - 1];
+  return NULL;
+}
+
+/* Take a team of NTHREADS threads out of the team cache of POOL, or
+   return NULL if there is none.  */
+
+static struct gomp_team *
+gomp_cached_team (struct gomp_thread_pool *pool, unsigned nthreads)
+{
+  unsigned i;
+
+  if (pool == NULL)
+    return NULL;
+  for (i = 0; i < GOMP_TEAM_CACHE_SIZE; i++)
+    {
+      struct gomp_team *team = pool->team_cache[i];
+
+      if (team != NULL && team->nthreads == nthreads)
+	{
+	  pool->team_cache[i] = NULL;
+	  return team;
 	}
-      while (local_fn);
     }
-
-  gomp_sem_destroy (&thr->release);
-  thr->thread_pool = NULL;
-  thr->task = NULL;
   return NULL;
 }
 
+/* Initialize the task deque DQ.  Deques are empty again whenever their
+   team ends, so they outlive teams, statistics included.  */
 
-/* Create a new team data structure.  */
+static void
+gomp_init_task_deque (struct gomp_task_deque *dq)
+{
+  dq->top = 0;
+  dq->bottom = 0;
+  dq->tasks = NULL;
+  dq->stolen = 0;
+  dq->created = 0;
+  dq->runs = 0;
+  dq->last_stolen = 0;
+  dq->avg_run_ns = 0;
+  dq->inbox = NULL;
+  dq->idle = 0;
+  gomp_mutex_init (&dq->inbox_lock);
+}
+
+static void
+gomp_fini_task_deque (struct gomp_task_deque *dq)
+{
+  free (dq->tasks);
+  gomp_mutex_destroy (&dq->inbox_lock);
+}
+
+/* Free the team slot of THR, if it has one.  */
+
+static void
+gomp_free_team_slot (struct gomp_thread *thr)
+{
+  if (thr->team_slot == NULL)
+    return;
+  gomp_fini_task_deque (&thr->team_slot->deque);
+  gomp_aligned_free (thr->team_slot);
+  thr->team_slot = NULL;
+}
+
+/* Create a new team data structure, or set up again one that ended
+   with the same number of threads.  */
 
 struct gomp_team *
 gomp_new_team (unsigned nthreads)
 {
+  struct gomp_thread *thr = gomp_thread ();
+  struct gomp_thread_pool *pool = gomp_team_pool (thr);
   struct gomp_team *team;
-  size_t size;
-  int i;
+  unsigned chunk;
 
-  size = sizeof (*team) + nthreads * (sizeof (team->ordered_release[0])
-				      + sizeof (team->implicit_task[0]));
-  team = gomp_malloc (size);
+  team = gomp_cached_team (pool, nthreads);
+  if (team != NULL)
+    gomp_team_barrier_reset (&team->barrier);
+  else
+    {
+      size_t offset, size;
+
+      /* Only the master's implicit task is in the team.  The barrier
+	 slots after it start a cache line of their own.  */
+      offset = (sizeof (*team) + sizeof (team->implicit_task[0]) + 63) & -64;
+      size = offset + nthreads * (sizeof (team->barrier_slots[0])
+				  + sizeof (team->ordered_release[0])
+				  + sizeof (team->task_deques[0]));
+      team = gomp_aligned_alloc (64, size);
+
+      team->nthreads = nthreads;
+      gomp_team_barrier_init (&team->barrier, nthreads);
+      team->barrier_slots = (void *) ((char *) team + offset);
+      team->ordered_release = (void *) &team->barrier_slots[nthreads];
+      team->task_deques = (void *) &team->ordered_release[nthreads];
+      gomp_init_task_deque (&team->master_deque);
+      team->task_deques[0] = &team->master_deque;
+      gomp_mutex_init (&team->task_lock);
+      team->work_share_ring = &team->work_shares[1];
+      team->work_share_chunk = GOMP_WORK_SHARE_RING;
+      gomp_init_work_share_pools (team->work_shares,
+				  1 + GOMP_WORK_SHARE_RING);
+    }
 
-  team->work_share_chunk = 8;
 #ifdef HAVE_SYNC_BUILTINS
   team->single_count = 0;
-#else
-  gomp_mutex_init (&team->work_share_list_free_lock);
 #endif
-  team->work_shares_to_free = &team->work_shares[0];
   gomp_init_work_share (&team->work_shares[0], false, nthreads);
-  team->work_shares[0].next_alloc = NULL;
-  team->work_share_list_free = NULL;
-  team->work_share_list_alloc = &team->work_shares[1];
-  for (i = 1; i < 7; i++)
-    team->work_shares[i].next_free = &team->work_shares[i + 1];
-  team->work_shares[i].next_free = NULL;
 
-  team->nthreads = nthreads;
-  gomp_barrier_init (&team->barrier, nthreads);
+  /* If earlier teams needed a larger work share ring, give this one
+     that large a ring right away.  A cached team keeps its ring.  */
+  chunk = pool != NULL ? __atomic_load_n (&pool->work_share_chunk,
+					   MEMMODEL_RELAXED)
+		       : GOMP_WORK_SHARE_RING;
+  if (__builtin_expect (chunk > team->work_share_chunk, 0))
+    {
+      if (team->work_share_ring != &team->work_shares[1])
+	{
+	  gomp_free_work_share_pools (team->work_share_ring,
+				      team->work_share_chunk);
+	  gomp_aligned_free (team->work_share_ring);
+	}
+      team->work_share_ring
+	= gomp_aligned_alloc (64, chunk * sizeof (struct gomp_work_share));
+      team->work_share_chunk = chunk;
+      gomp_init_work_share_pools (team->work_share_ring, chunk);
+    }
+  gomp_work_share_ring_reset (team);
 
   gomp_sem_init (&team->master_release, 0);
-  team->ordered_release = (void *) &team->implicit_task[nthreads];
   team->ordered_release[0] = &team->master_release;
 
-  gomp_mutex_init (&team->task_lock);
   team->task_queue = NULL;
+  team->task_prio_mask = 0;
+  memset (team->task_prio_queue, 0, sizeof (team->task_prio_queue));
   team->task_count = 0;
   team->task_queued_count = 0;
+  team->task_cutoff = gomp_task_cutoff_max_var;
+  team->task_starved = 0;
   team->task_running_count = 0;
   team->work_share_cancelled = 0;
   team->team_cancelled = 0;
@@ -186,9 +445,54 @@ gomp_new_team (unsigned nthreads)
 static void
 free_team (struct gomp_team *team)
 {
+  gomp_fini_task_deque (&team->master_deque);
   gomp_barrier_destroy (&team->barrier);
   gomp_mutex_destroy (&team->task_lock);
-  free (team);
+  if (team->work_share_ring != &team->work_shares[1])
+    {
+      gomp_free_work_share_pools (team->work_share_ring,
+				  team->work_share_chunk);
+      gomp_aligned_free (team->work_share_ring);
+    }
+  gomp_free_work_share_pools (team->work_shares, 1 + GOMP_WORK_SHARE_RING);
+  gomp_aligned_free (team);
+}
+
+/* Make the teams POOL starts from now on get as large a work share ring
+   as TEAM, which has just ended, would have needed.  */
+
+static inline void
+gomp_work_share_ring_grow (struct gomp_thread_pool *pool,
+			   struct gomp_team *team)
+{
+  unsigned want = __atomic_load_n (&team->work_share_want, MEMMODEL_RELAXED);
+  unsigned chunk = __atomic_load_n (&pool->work_share_chunk,
+				    MEMMODEL_RELAXED);
+
+  while (chunk < want
+	 && !__atomic_compare_exchange_n (&pool->work_share_chunk, &chunk,
+					  want, false, MEMMODEL_RELAXED,
+					  MEMMODEL_RELAXED))
+    ;
+}
+
+/* Keep TEAM, which its threads are done with, in the team cache of POOL,
+   evicting an older team if the cache is full.  */
+
+static void
+gomp_cache_team (struct gomp_thread_pool *pool, struct gomp_team *team)
+{
+  unsigned i;
+
+  for (i = 0; i < GOMP_TEAM_CACHE_SIZE; i++)
+    if (pool->team_cache[i] == NULL)
+      {
+	pool->team_cache[i] = team;
+	return;
+      }
+  i = pool->team_cache_next++ % GOMP_TEAM_CACHE_SIZE;
+  free_team (pool->team_cache[i]);
+  pool->team_cache[i] = team;
 }
 
 /* Allocate and initialize a thread pool. */
@@ -198,9 +502,13 @@ static struct gomp_thread_pool *gomp_new_thread_pool (void)
   struct gomp_thread_pool *pool
     = gomp_malloc (sizeof(struct gomp_thread_pool));
   pool->threads = NULL;
+  pool->task_deques = NULL;
   pool->threads_size = 0;
   pool->threads_used = 0;
   pool->last_team = NULL;
+  memset (pool->team_cache, 0, sizeof (pool->team_cache));
+  pool->team_cache_next = 0;
+  pool->work_share_chunk = GOMP_WORK_SHARE_RING;
   return pool;
 }
 
@@ -210,52 +518,89 @@ gomp_free_pool_helper (void *thread_pool)
   struct gomp_thread *thr = gomp_thread ();
   struct gomp_thread_pool *pool
     = (struct gomp_thread_pool *) thread_pool;
+  gomp_free_nested_pools (thr);
   gomp_barrier_wait_last (&pool->threads_dock);
   gomp_sem_destroy (&thr->release);
+  gomp_slab_release (thr);
   thr->thread_pool = NULL;
   thr->task = NULL;
+  gomp_free_team_slot (thr);
   pthread_exit (NULL);
 }
 
-/* Free a thread pool and release its threads. */
+/* Release the threads of POOL and free it.  */
 
-void
-gomp_free_thread (void *arg __attribute__((unused)))
+static void
+gomp_free_pool (struct gomp_thread_pool *pool)
 {
-  struct gomp_thread *thr = gomp_thread ();
-  struct gomp_thread_pool *pool = thr->thread_pool;
-  if (pool)
+  int i;
+
+  if (pool->threads_used > 0)
     {
-      if (pool->threads_used > 0)
+      gomp_barrier_state_t target
+	= gomp_barrier_dock_target (&pool->threads_dock);
+      for (i = 1; i < pool->threads_used; i++)
 	{
-	  int i;
-	  for (i = 1; i < pool->threads_used; i++)
-	    {
-	      struct gomp_thread *nthr = pool->threads[i];
-	      nthr->fn = gomp_free_pool_helper;
-	      nthr->data = pool;
-	    }
-	  /* This barrier undocks threads docked on pool->threads_dock.  */
-	  gomp_barrier_wait (&pool->threads_dock);
-	  /* And this waits till all threads have called gomp_barrier_wait_last
-	     in gomp_free_pool_helper.  */
-	  gomp_barrier_wait (&pool->threads_dock);
-	  /* Now it is safe to destroy the barrier and free the pool.  */
-	  gomp_barrier_destroy (&pool->threads_dock);
+	  struct gomp_thread *nthr = pool->threads[i];
+	  nthr->fn = gomp_free_pool_helper;
+	  nthr->data = pool;
+	  nthr->ts.team = NULL;
+	}
+      /* This barrier and gomp_barrier_undock undock threads docked on
+	 pool->threads_dock.  */
+      gomp_barrier_wait (&pool->threads_dock);
+      for (i = 1; i < pool->threads_used; i++)
+	gomp_barrier_undock (&pool->threads[i]->dock_go, target);
+      /* And this waits till all threads have called gomp_barrier_wait_last
+	 in gomp_free_pool_helper.  */
+      gomp_barrier_wait (&pool->threads_dock);
+      /* Now it is safe to destroy the barrier and free the pool.  */
+      gomp_barrier_destroy (&pool->threads_dock);
 
 #ifdef HAVE_SYNC_BUILTINS
-	  __sync_fetch_and_add (&gomp_managed_threads,
-				1L - pool->threads_used);
+      __sync_fetch_and_add (&gomp_managed_threads,
+			    1L - pool->threads_used);
 #else
-	  gomp_mutex_lock (&gomp_managed_threads_lock);
-	  gomp_managed_threads -= pool->threads_used - 1L;
-	  gomp_mutex_unlock (&gomp_managed_threads_lock);
+      gomp_mutex_lock (&gomp_managed_threads_lock);
+      gomp_managed_threads -= pool->threads_used - 1L;
+      gomp_mutex_unlock (&gomp_managed_threads_lock);
 #endif
-	}
-      free (pool->threads);
-      if (pool->last_team)
-	free_team (pool->last_team);
-      free (pool);
+    }
+  free (pool->threads);
+  free (pool->task_deques);
+  if (pool->last_team)
+    free_team (pool->last_team);
+  for (i = 0; i < GOMP_TEAM_CACHE_SIZE; i++)
+    if (pool->team_cache[i] != NULL)
+      free_team (pool->team_cache[i]);
+  free (pool);
+}
+
+/* Free the pools of the nested teams THR has been the master of.  */
+
+static void
+gomp_free_nested_pools (struct gomp_thread *thr)
+{
+  unsigned i;
+
+  for (i = 0; i < thr->nested_pools_size; i++)
+    if (thr->nested_pools[i] != NULL)
+      gomp_free_pool (thr->nested_pools[i]);
+  free (thr->nested_pools);
+  thr->nested_pools = NULL;
+  thr->nested_pools_size = 0;
+}
+
+/* Free the thread pools of this thread and release their threads. */
+
+void
+gomp_free_thread (void *arg __attribute__((unused)))
+{
+  struct gomp_thread *thr = gomp_thread ();
+  gomp_free_nested_pools (thr);
+  if (thr->thread_pool)
+    {
+      gomp_free_pool (thr->thread_pool);
       thr->thread_pool = NULL;
     }
   if (thr->task != NULL)
@@ -279,12 +624,13 @@ gomp_team_start (void (*fn) (void *), void *data, unsigned nthreads,
   bool nested;
   struct gomp_thread_pool *pool;
   unsigned i, n, old_threads_used = 0;
-  pthread_attr_t thread_attr, *attr;
+  gomp_barrier_state_t target = 0;
   unsigned long nthreads_var;
   char bind, bind_var;
   unsigned int s = 0, rest = 0, p = 0, k = 0;
   unsigned int affinity_count = 0;
   struct gomp_thread **affinity_thr = NULL;
+  unsigned int *places = NULL;
 
   thr = gomp_thread ();
   nested = thr->ts.team != NULL;
@@ -311,11 +657,12 @@ gomp_team_start (void (*fn) (void *), void *data, unsigned nthreads,
   if (nthreads > 1)
     ++thr->ts.active_level;
   thr->ts.work_share = &team->work_shares[0];
-  thr->ts.last_work_share = NULL;
+  thr->ts.work_share_seq = 0;
 #ifdef HAVE_SYNC_BUILTINS
   thr->ts.single_count = 0;
 #endif
   thr->ts.static_trip = 0;
+  thr->ts.taskmap_cursor = 0;
   thr->task = &team->implicit_task[0];
   nthreads_var = icv->nthreads_var;
   if (__builtin_expect (gomp_nthreads_var_list != NULL, 0)
@@ -335,6 +682,36 @@ gomp_team_start (void (*fn) (void *), void *data, unsigned nthreads,
   if (nthreads == 1)
     return;
 
+  /* Nested teams draw from a pool of their master's own for the level,
+     so that each pool is only ever modified by one thread.  */
+  if (nested)
+    {
+      unsigned level = thr->ts.level - 2;
+
+      if (__builtin_expect (level >= thr->nested_pools_size, 0))
+	{
+	  thr->nested_pools
+	    = gomp_realloc (thr->nested_pools,
+			    (level + 1) * sizeof (struct gomp_thread_pool *));
+	  memset (&thr->nested_pools[thr->nested_pools_size], '\0',
+		  (level + 1 - thr->nested_pools_size)
+		  * sizeof (struct gomp_thread_pool *));
+	  thr->nested_pools_size = level + 1;
+	}
+      if (__builtin_expect (thr->nested_pools[level] == NULL, 0))
+	thr->nested_pools[level] = gomp_new_thread_pool ();
+      pool = thr->nested_pools[level];
+    }
+
+  /* With GOMP_BARRIER=topology, the tree of the team barrier is built
+     from the places the threads end up bound to.  */
+  if (__builtin_expect (gomp_barrier_var == GOMP_BARRIER_TOPOLOGY, 0)
+      && gomp_places_list != NULL)
+    {
+      places = gomp_alloca (nthreads * sizeof (unsigned int));
+      places[0] = thr->place;
+    }
+
   i = 1;
 
   if (__builtin_expect (gomp_places_list != NULL, 0))
@@ -405,60 +782,102 @@ gomp_team_start (void (*fn) (void *), void *data, unsigned nthreads,
   else
     bind = omp_proc_bind_false;
 
-  /* We only allow the reuse of idle threads for non-nested PARALLEL
-     regions.  This appears to be implied by the semantics of
-     threadprivate variables, but perhaps that's reading too much into
-     things.  Certainly it does prevent any locking problems, since
-     only the initial program thread will modify gomp_threads.  */
-  if (!nested)
-    {
-      old_threads_used = pool->threads_used;
-
-      if (nthreads <= old_threads_used)
-	n = nthreads;
-      else if (old_threads_used == 0)
-	{
-	  n = 0;
-	  gomp_barrier_init (&pool->threads_dock, nthreads);
-	}
-      else
-	{
-	  n = old_threads_used;
-
-	  /* Increase the barrier threshold to make sure all new
-	     threads arrive before the team is released.  */
-	  gomp_barrier_reinit (&pool->threads_dock, nthreads);
-	}
+  /* Reuse the idle threads of the pool.  */
+  old_threads_used = pool->threads_used;
 
-      /* Not true yet, but soon will be.  We're going to release all
-	 threads from the dock, and those that aren't part of the
-	 team will exit.  */
-      pool->threads_used = nthreads;
+  if (nthreads <= old_threads_used)
+    n = nthreads;
+  else if (old_threads_used == 0)
+    {
+      n = 0;
+      gomp_barrier_init (&pool->threads_dock, nthreads);
+    }
+  else
+    {
+      n = old_threads_used;
 
-      /* If necessary, expand the size of the gomp_threads array.  It is
-	 expected that changes in the number of threads are rare, thus we
-	 make no effort to expand gomp_threads_size geometrically.  */
-      if (nthreads >= pool->threads_size)
-	{
-	  pool->threads_size = nthreads + 1;
-	  pool->threads
-	    = gomp_realloc (pool->threads,
-			    pool->threads_size
-			    * sizeof (struct gomp_thread_data *));
-	}
+      /* Increase the barrier threshold to make sure all new
+	 threads arrive before the team is released.  */
+      gomp_barrier_reinit (&pool->threads_dock, nthreads);
+    }
+  target = gomp_barrier_dock_target (&pool->threads_dock);
+
+  /* The threads of the team are set up by gomp_team_launch.  */
+  team->launch_fn = fn;
+  team->launch_data = data;
+  team->launch_parent = task;
+  team->launch_icv = *icv;
+  team->launch_icv.nthreads_var = nthreads_var;
+  team->launch_icv.bind_var = bind_var;
+
+  /* Not true yet, but soon will be.  We're going to release all
+     threads from the dock, and those that aren't part of the
+     team will exit.  */
+  pool->threads_used = nthreads;
+
+  /* If necessary, expand the size of the gomp_threads array.  It is
+     expected that changes in the number of threads are rare, thus we
+     make no effort to expand gomp_threads_size geometrically.  */
+  if (nthreads >= pool->threads_size)
+    {
+      pool->threads_size = nthreads + 1;
+      pool->threads
+	= gomp_realloc (pool->threads,
+			pool->threads_size
+			* sizeof (struct gomp_thread_data *));
+      pool->task_deques
+	= gomp_realloc (pool->task_deques,
+			pool->threads_size
+			* sizeof (struct gomp_task_deque *));
+    }
 
-      /* Release existing idle threads.  */
-      for (; i < n; ++i)
+  /* Place existing idle threads.  */
+  for (; i < n; ++i)
+    {
+      unsigned int place_partition_off = thr->ts.place_partition_off;
+      unsigned int place_partition_len = thr->ts.place_partition_len;
+      unsigned int place = 0;
+      if (__builtin_expect (gomp_places_list != NULL, 0))
 	{
-	  unsigned int place_partition_off = thr->ts.place_partition_off;
-	  unsigned int place_partition_len = thr->ts.place_partition_len;
-	  unsigned int place = 0;
-	  if (__builtin_expect (gomp_places_list != NULL, 0))
+	  switch (bind)
 	    {
-	      switch (bind)
+	    case omp_proc_bind_true:
+	    case omp_proc_bind_close:
+	      if (k == s)
 		{
-		case omp_proc_bind_true:
-		case omp_proc_bind_close:
+		  ++p;
+		  if (p == (team->prev_ts.place_partition_off
+			    + team->prev_ts.place_partition_len))
+		    p = team->prev_ts.place_partition_off;
+		  k = 1;
+		  if (i == nthreads - rest)
+		    s = 1;
+		}
+	      else
+		++k;
+	      break;
+	    case omp_proc_bind_master:
+	      break;
+	    case omp_proc_bind_spread:
+	      if (k == 0)
+		{
+		  /* T <= P.  */
+		  if (p < rest)
+		    p += s + 1;
+		  else
+		    p += s;
+		  if (p == (team->prev_ts.place_partition_off
+			    + team->prev_ts.place_partition_len))
+		    p = team->prev_ts.place_partition_off;
+		  place_partition_off = p;
+		  if (p < rest)
+		    place_partition_len = s + 1;
+		  else
+		    place_partition_len = s;
+		}
+	      else
+		{
+		  /* T > P.  */
 		  if (k == s)
 		    {
 		      ++p;
@@ -471,205 +890,155 @@ gomp_team_start (void (*fn) (void *), void *data, unsigned nthreads,
 		    }
 		  else
 		    ++k;
-		  break;
-		case omp_proc_bind_master:
-		  break;
-		case omp_proc_bind_spread:
-		  if (k == 0)
-		    {
-		      /* T <= P.  */
-		      if (p < rest)
-			p += s + 1;
-		      else
-			p += s;
-		      if (p == (team->prev_ts.place_partition_off
-				+ team->prev_ts.place_partition_len))
-			p = team->prev_ts.place_partition_off;
-		      place_partition_off = p;
-		      if (p < rest)
-			place_partition_len = s + 1;
-		      else
-			place_partition_len = s;
-		    }
+		  place_partition_off = p;
+		  place_partition_len = 1;
+		}
+	      break;
+	    }
+	  if (affinity_thr != NULL
+	      || (bind != omp_proc_bind_true
+		  && pool->threads[i]->place != p + 1)
+	      || pool->threads[i]->place <= place_partition_off
+	      || pool->threads[i]->place > (place_partition_off
+					    + place_partition_len))
+	    {
+	      unsigned int l;
+	      if (affinity_thr == NULL)
+		{
+		  unsigned int j;
+
+		  if (team->prev_ts.place_partition_len > 64)
+		    affinity_thr
+		      = gomp_malloc (team->prev_ts.place_partition_len
+				     * sizeof (struct gomp_thread *));
 		  else
+		    affinity_thr
+		      = gomp_alloca (team->prev_ts.place_partition_len
+				     * sizeof (struct gomp_thread *));
+		  memset (affinity_thr, '\0',
+			  team->prev_ts.place_partition_len
+			  * sizeof (struct gomp_thread *));
+		  for (j = i; j < old_threads_used; j++)
 		    {
-		      /* T > P.  */
-		      if (k == s)
+		      if (pool->threads[j]->place
+			  > team->prev_ts.place_partition_off
+			  && (pool->threads[j]->place
+			      <= (team->prev_ts.place_partition_off
+				  + team->prev_ts.place_partition_len)))
 			{
-			  ++p;
-			  if (p == (team->prev_ts.place_partition_off
-				    + team->prev_ts.place_partition_len))
-			    p = team->prev_ts.place_partition_off;
-			  k = 1;
-			  if (i == nthreads - rest)
-			    s = 1;
+			  l = pool->threads[j]->place - 1
+			      - team->prev_ts.place_partition_off;
+			  pool->threads[j]->data = affinity_thr[l];
+			  affinity_thr[l] = pool->threads[j];
 			}
-		      else
-			++k;
-		      place_partition_off = p;
-		      place_partition_len = 1;
+		      pool->threads[j] = NULL;
 		    }
-		  break;
+		  if (nthreads > old_threads_used)
+		    memset (&pool->threads[old_threads_used],
+			    '\0', ((nthreads - old_threads_used)
+				   * sizeof (struct gomp_thread *)));
+		  n = nthreads;
+		  affinity_count = old_threads_used - i;
 		}
-	      if (affinity_thr != NULL
-		  || (bind != omp_proc_bind_true
-		      && pool->threads[i]->place != p + 1)
-		  || pool->threads[i]->place <= place_partition_off
-		  || pool->threads[i]->place > (place_partition_off
-						+ place_partition_len))
+	      if (affinity_count == 0)
+		break;
+	      l = p;
+	      if (affinity_thr[l - team->prev_ts.place_partition_off]
+		  == NULL)
 		{
-		  unsigned int l;
-		  if (affinity_thr == NULL)
-		    {
-		      unsigned int j;
-
-		      if (team->prev_ts.place_partition_len > 64)
-			affinity_thr
-			  = gomp_malloc (team->prev_ts.place_partition_len
-					 * sizeof (struct gomp_thread *));
-		      else
-			affinity_thr
-			  = gomp_alloca (team->prev_ts.place_partition_len
-					 * sizeof (struct gomp_thread *));
-		      memset (affinity_thr, '\0',
-			      team->prev_ts.place_partition_len
-			      * sizeof (struct gomp_thread *));
-		      for (j = i; j < old_threads_used; j++)
-			{
-			  if (pool->threads[j]->place
-			      > team->prev_ts.place_partition_off
-			      && (pool->threads[j]->place
-				  <= (team->prev_ts.place_partition_off
-				      + team->prev_ts.place_partition_len)))
-			    {
-			      l = pool->threads[j]->place - 1
-				  - team->prev_ts.place_partition_off;
-			      pool->threads[j]->data = affinity_thr[l];
-			      affinity_thr[l] = pool->threads[j];
-			    }
-			  pool->threads[j] = NULL;
-			}
-		      if (nthreads > old_threads_used)
-			memset (&pool->threads[old_threads_used],
-				'\0', ((nthreads - old_threads_used)
-				       * sizeof (struct gomp_thread *)));
-		      n = nthreads;
-		      affinity_count = old_threads_used - i;
-		    }
-		  if (affinity_count == 0)
-		    break;
-		  l = p;
-		  if (affinity_thr[l - team->prev_ts.place_partition_off]
-		      == NULL)
-		    {
-		      if (bind != omp_proc_bind_true)
-			continue;
-		      for (l = place_partition_off;
-			   l < place_partition_off + place_partition_len;
-			   l++)
-			if (affinity_thr[l - team->prev_ts.place_partition_off]
-			    != NULL)
-			  break;
-		      if (l == place_partition_off + place_partition_len)
-			continue;
-		    }
-		  nthr = affinity_thr[l - team->prev_ts.place_partition_off];
-		  affinity_thr[l - team->prev_ts.place_partition_off]
-		    = (struct gomp_thread *) nthr->data;
-		  affinity_count--;
-		  pool->threads[i] = nthr;
+		  if (bind != omp_proc_bind_true)
+		    continue;
+		  for (l = place_partition_off;
+		       l < place_partition_off + place_partition_len;
+		       l++)
+		    if (affinity_thr[l - team->prev_ts.place_partition_off]
+			!= NULL)
+		      break;
+		  if (l == place_partition_off + place_partition_len)
+		    continue;
 		}
-	      else
-		nthr = pool->threads[i];
-	      place = p + 1;
+	      nthr = affinity_thr[l - team->prev_ts.place_partition_off];
+	      affinity_thr[l - team->prev_ts.place_partition_off]
+		= (struct gomp_thread *) nthr->data;
+	      affinity_count--;
+	      pool->threads[i] = nthr;
+	      pool->task_deques[i] = &nthr->team_slot->deque;
 	    }
 	  else
 	    nthr = pool->threads[i];
-	  nthr->ts.team = team;
-	  nthr->ts.work_share = &team->work_shares[0];
-	  nthr->ts.last_work_share = NULL;
-	  nthr->ts.team_id = i;
-	  nthr->ts.level = team->prev_ts.level + 1;
-	  nthr->ts.active_level = thr->ts.active_level;
+	  place = p + 1;
 	  nthr->ts.place_partition_off = place_partition_off;
 	  nthr->ts.place_partition_len = place_partition_len;
-#ifdef HAVE_SYNC_BUILTINS
-	  nthr->ts.single_count = 0;
-#endif
-	  nthr->ts.static_trip = 0;
-	  nthr->task = &team->implicit_task[i];
 	  nthr->place = place;
-	  gomp_init_task (nthr->task, task, icv);
-	  team->implicit_task[i].icv.nthreads_var = nthreads_var;
-	  team->implicit_task[i].icv.bind_var = bind_var;
-	  nthr->fn = fn;
-	  nthr->data = data;
-	  team->ordered_release[i] = &nthr->release;
+	  if (places)
+	    places[i] = place;
 	}
+    }
 
-      if (__builtin_expect (affinity_thr != NULL, 0))
+  if (__builtin_expect (affinity_thr != NULL, 0))
+    {
+      /* If AFFINITY_THR is non-NULL just because we had to
+	 permute some threads in the pool, but we've managed
+	 to find exactly as many old threads as we'd find
+	 without affinity, we don't need to handle this
+	 specially anymore.  */
+      if (nthreads <= old_threads_used
+	  ? (affinity_count == old_threads_used - nthreads)
+	  : (i == old_threads_used))
 	{
-	  /* If AFFINITY_THR is non-NULL just because we had to
-	     permute some threads in the pool, but we've managed
-	     to find exactly as many old threads as we'd find
-	     without affinity, we don't need to handle this
-	     specially anymore.  */
-	  if (nthreads <= old_threads_used
-	      ? (affinity_count == old_threads_used - nthreads)
-	      : (i == old_threads_used))
-	    {
-	      if (team->prev_ts.place_partition_len > 64)
-		free (affinity_thr);
-	      affinity_thr = NULL;
-	      affinity_count = 0;
-	    }
-	  else
+	  gomp_undock_affinity_thr (affinity_thr,
+				    team->prev_ts.place_partition_len,
+				    target);
+	  if (team->prev_ts.place_partition_len > 64)
+	    free (affinity_thr);
+	  affinity_thr = NULL;
+	  affinity_count = 0;
+	}
+      else
+	{
+	  i = 1;
+	  /* We are going to compute the places/subpartitions
+	     again from the beginning.  So, we need to reinitialize
+	     vars modified by the switch (bind) above inside
+	     of the loop, to the state they had after the initial
+	     switch (bind).  */
+	  switch (bind)
 	    {
-	      i = 1;
-	      /* We are going to compute the places/subpartitions
-		 again from the beginning.  So, we need to reinitialize
-		 vars modified by the switch (bind) above inside
-		 of the loop, to the state they had after the initial
-		 switch (bind).  */
-	      switch (bind)
+	    case omp_proc_bind_true:
+	    case omp_proc_bind_close:
+	      if (nthreads > thr->ts.place_partition_len)
+		/* T > P.  S has been changed, so needs
+		   to be recomputed.  */
+		s = nthreads / thr->ts.place_partition_len;
+	      k = 1;
+	      p = thr->place - 1;
+	      break;
+	    case omp_proc_bind_master:
+	      /* No vars have been changed.  */
+	      break;
+	    case omp_proc_bind_spread:
+	      p = thr->ts.place_partition_off;
+	      if (k != 0)
 		{
-		case omp_proc_bind_true:
-		case omp_proc_bind_close:
-		  if (nthreads > thr->ts.place_partition_len)
-		    /* T > P.  S has been changed, so needs
-		       to be recomputed.  */
-		    s = nthreads / thr->ts.place_partition_len;
+		  /* T > P.  */
+		  s = nthreads / team->prev_ts.place_partition_len;
 		  k = 1;
-		  p = thr->place - 1;
-		  break;
-		case omp_proc_bind_master:
-		  /* No vars have been changed.  */
-		  break;
-		case omp_proc_bind_spread:
-		  p = thr->ts.place_partition_off;
-		  if (k != 0)
-		    {
-		      /* T > P.  */
-		      s = nthreads / team->prev_ts.place_partition_len;
-		      k = 1;
-		    }
-		  break;
 		}
-
-	      /* Increase the barrier threshold to make sure all new
-		 threads and all the threads we're going to let die
-		 arrive before the team is released.  */
-	      if (affinity_count)
-		gomp_barrier_reinit (&pool->threads_dock,
-				     nthreads + affinity_count);
+	      break;
 	    }
-	}
-
-      if (i == nthreads)
-	goto do_release;
 
+	  /* Increase the barrier threshold to make sure all new
+	     threads and all the threads we're going to let die
+	     arrive before the team is released.  */
+	  if (affinity_count)
+	    gomp_barrier_reinit (&pool->threads_dock,
+				 nthreads + affinity_count);
+	}
     }
 
+  if (i == nthreads)
+    goto do_release;
+
   if (__builtin_expect (nthreads + affinity_count > old_threads_used, 0))
     {
       long diff = (long) (nthreads + affinity_count) - (long) old_threads_used;
@@ -686,29 +1055,24 @@ gomp_team_start (void (*fn) (void *), void *data, unsigned nthreads,
 #endif
     }
 
-  attr = &gomp_thread_attr;
-  if (__builtin_expect (gomp_places_list != NULL, 0))
-    {
-      size_t stacksize;
-      pthread_attr_init (&thread_attr);
-      pthread_attr_setdetachstate (&thread_attr, PTHREAD_CREATE_DETACHED);
-      if (! pthread_attr_getstacksize (&gomp_thread_attr, &stacksize))
-	pthread_attr_setstacksize (&thread_attr, stacksize);
-      attr = &thread_attr;
-    }
-
   start_data = gomp_alloca (sizeof (struct gomp_thread_start_data)
-			    * (nthreads-i));
-
-  /* Launch new threads.  */
+			    * nthreads);
+  start_data[0].all = start_data;
+  start_data[0].nthreads = nthreads;
+  start_data[0].ts.team_id = 0;
+  start_data[0].create = false;
+  for (n = 1; n < i; n++)
+    start_data[n].create = false;
+
+  /* Set up new threads.  */
   for (; i < nthreads; ++i)
     {
-      pthread_t pt;
-      int err;
+      struct gomp_thread_start_data *sd = &start_data[i];
 
-      start_data->ts.place_partition_off = thr->ts.place_partition_off;
-      start_data->ts.place_partition_len = thr->ts.place_partition_len;
-      start_data->place = 0;
+      sd->create = false;
+      sd->ts.place_partition_off = thr->ts.place_partition_off;
+      sd->ts.place_partition_len = thr->ts.place_partition_len;
+      sd->place = 0;
       if (__builtin_expect (gomp_places_list != NULL, 0))
 	{
 	  switch (bind)
@@ -741,11 +1105,11 @@ gomp_team_start (void (*fn) (void *), void *data, unsigned nthreads,
 		  if (p == (team->prev_ts.place_partition_off
 			    + team->prev_ts.place_partition_len))
 		    p = team->prev_ts.place_partition_off;
-		  start_data->ts.place_partition_off = p;
+		  sd->ts.place_partition_off = p;
 		  if (p < rest)
-		    start_data->ts.place_partition_len = s + 1;
+		    sd->ts.place_partition_len = s + 1;
 		  else
-		    start_data->ts.place_partition_len = s;
+		    sd->ts.place_partition_len = s;
 		}
 	      else
 		{
@@ -762,51 +1126,64 @@ gomp_team_start (void (*fn) (void *), void *data, unsigned nthreads,
 		    }
 		  else
 		    ++k;
-		  start_data->ts.place_partition_off = p;
-		  start_data->ts.place_partition_len = 1;
+		  sd->ts.place_partition_off = p;
+		  sd->ts.place_partition_len = 1;
 		}
 	      break;
 	    }
-	  start_data->place = p + 1;
+	  sd->place = p + 1;
+	  if (places)
+	    places[i] = p + 1;
 	  if (affinity_thr != NULL && pool->threads[i] != NULL)
 	    continue;
-	  gomp_init_thread_affinity (attr, p);
 	}
 
-      start_data->fn = fn;
-      start_data->fn_data = data;
-      start_data->ts.team = team;
-      start_data->ts.work_share = &team->work_shares[0];
-      start_data->ts.last_work_share = NULL;
-      start_data->ts.team_id = i;
-      start_data->ts.level = team->prev_ts.level + 1;
-      start_data->ts.active_level = thr->ts.active_level;
+      sd->fn = fn;
+      sd->fn_data = data;
+      sd->ts.team = team;
+      sd->ts.work_share = &team->work_shares[0];
+      sd->ts.work_share_seq = 0;
+      sd->ts.team_id = i;
+      sd->ts.level = team->prev_ts.level + 1;
+      sd->ts.active_level = thr->ts.active_level;
 #ifdef HAVE_SYNC_BUILTINS
-      start_data->ts.single_count = 0;
+      sd->ts.single_count = 0;
 #endif
-      start_data->ts.static_trip = 0;
-      start_data->task = &team->implicit_task[i];
-      gomp_init_task (start_data->task, task, icv);
-      team->implicit_task[i].icv.nthreads_var = nthreads_var;
-      team->implicit_task[i].icv.bind_var = bind_var;
-      start_data->thread_pool = pool;
-      start_data->nested = nested;
-
-      err = pthread_create (&pt, attr, gomp_thread_start, start_data++);
-      if (err != 0)
-	gomp_fatal ("Thread creation failed: %s", strerror (err));
+      sd->ts.static_trip = 0;
+      sd->ts.taskmap_cursor = 0;
+      sd->thread_pool = thr->thread_pool;
+      sd->dock_pool = pool;
+      sd->all = start_data;
+      sd->nthreads = nthreads;
+      sd->create = true;
     }
 
-  if (__builtin_expect (gomp_places_list != NULL, 0))
-    pthread_attr_destroy (&thread_attr);
+  /* Launch them.  */
+  gomp_thread_create_children (start_data);
 
  do_release:
-  gomp_barrier_wait (nested ? &team->barrier : &pool->threads_dock);
+  if (places)
+    gomp_team_barrier_init_places (&team->barrier, places);
+  /* Threads leaving the pool can go right away.  */
+  if (__builtin_expect (affinity_thr != NULL, 0))
+    gomp_undock_affinity_thr (affinity_thr,
+			      team->prev_ts.place_partition_len, target);
+  else
+    for (i = nthreads; i < old_threads_used; i++)
+      if (pool->threads[i] != NULL)
+	gomp_barrier_undock (&pool->threads[i]->dock_go, target);
+  gomp_barrier_wait (&pool->threads_dock);
+
+  /* All the threads of the team have registered their deques by now.  */
+  memcpy (&team->task_deques[1], &pool->task_deques[1],
+	  (nthreads - 1) * sizeof (struct gomp_task_deque *));
+
+  /* Set up and release the team down the launch tree.  */
+  gomp_team_launch (pool, team, 0, target);
 
   /* Decrease the barrier threshold to match the number of threads
      that should arrive back at the end of this team.  The extra
-     threads should be exiting.  Note that we arrange for this test
-     to never be true for nested teams.  If AFFINITY_COUNT is non-zero,
+     threads should be exiting.  If AFFINITY_COUNT is non-zero,
      the barrier as well as gomp_managed_threads was temporarily
      set to NTHREADS + AFFINITY_COUNT.  For NTHREADS < OLD_THREADS_COUNT,
      AFFINITY_COUNT if non-zero will be always at least
@@ -843,6 +1220,7 @@ gomp_team_end (void)
 {
   struct gomp_thread *thr = gomp_thread ();
   struct gomp_team *team = thr->ts.team;
+  struct gomp_thread_pool *pool;
 
   /* This barrier handles all pending explicit threads.
      As #pragma omp cancel parallel might get awaited count in
@@ -851,61 +1229,37 @@ gomp_team_end (void)
   gomp_team_barrier_wait_final (&team->barrier);
   if (__builtin_expect (team->team_cancelled, 0))
     {
-      struct gomp_work_share *ws = team->work_shares_to_free;
-      do
-	{
-	  struct gomp_work_share *next_ws = gomp_ptrlock_get (&ws->next_ws);
-	  if (next_ws == NULL)
-	    gomp_ptrlock_set (&ws->next_ws, ws);
-	  gomp_fini_work_share (ws);
-	  ws = next_ws;
-	}
-      while (ws != NULL);
+      unsigned i;
+
+      /* The threads may have left constructs that were never released,
+	 those whose slot still says initialized.  */
+      for (i = 0; i < team->work_share_chunk; i++)
+	if (team->work_share_ring[i].ring_serving & 1)
+	  gomp_fini_work_share (&team->work_share_ring[i]);
     }
-  else
-    gomp_fini_work_share (thr->ts.work_share);
+  gomp_fini_work_share (&team->work_shares[0]);
 
   gomp_end_task ();
   thr->ts = team->prev_ts;
 
-  if (__builtin_expect (thr->ts.team != NULL, 0))
-    {
-#ifdef HAVE_SYNC_BUILTINS
-      __sync_fetch_and_add (&gomp_managed_threads, 1L - team->nthreads);
-#else
-      gomp_mutex_lock (&gomp_managed_threads_lock);
-      gomp_managed_threads -= team->nthreads - 1L;
-      gomp_mutex_unlock (&gomp_managed_threads_lock);
-#endif
-      /* This barrier has gomp_barrier_wait_last counterparts
-	 and ensures the team can be safely destroyed.  */
-      gomp_barrier_wait (&team->barrier);
-    }
+  gomp_sem_destroy (&team->master_release);
 
-  if (__builtin_expect (team->work_shares[0].next_alloc != NULL, 0))
+  pool = gomp_team_pool (thr);
+  if (pool != NULL)
+    gomp_work_share_ring_grow (pool, team);
+  if (__builtin_expect (team->nthreads == 1, 0))
     {
-      struct gomp_work_share *ws = team->work_shares[0].next_alloc;
-      do
-	{
-	  struct gomp_work_share *next_ws = ws->next_alloc;
-	  free (ws);
-	  ws = next_ws;
-	}
-      while (ws != NULL);
+      if (pool != NULL)
+	gomp_cache_team (pool, team);
+      else
+	free_team (team);
     }
-  gomp_sem_destroy (&team->master_release);
-#ifndef HAVE_SYNC_BUILTINS
-  gomp_mutex_destroy (&team->work_share_list_free_lock);
-#endif
-
-  if (__builtin_expect (thr->ts.team != NULL, 0)
-      || __builtin_expect (team->nthreads == 1, 0))
-    free_team (team);
   else
     {
-      struct gomp_thread_pool *pool = thr->thread_pool;
+      /* The threads may still be on their way to the dock, so the team
+	 is only reused once the next one has been through it.  */
       if (pool->last_team)
-	free_team (pool->last_team);
+	gomp_cache_team (pool, pool->last_team);
       pool->last_team = team;
     }
 }
@@ -0,0 +1,53 @@
+/* { dg-do run } */
+
+#include <omp.h>
+#include <stdlib.h>
+
+#define ITERS 200
+
+int
+main (void)
+{
+  int nt, err = 0;
+
+  /* Outside of a parallel region the value comes back unchanged.  */
+  if (omp_barrier_reduce_int (5, omp_reduction_sum) != 5
+      || omp_barrier_reduce_double (2.5, omp_reduction_max) != 2.5)
+    abort ();
+
+  for (nt = 1; nt <= 8; nt++)
+    #pragma omp parallel num_threads (nt) reduction (|:err)
+    {
+      int n = omp_get_num_threads ();
+      int me = omp_get_thread_num ();
+      int it;
+
+      for (it = 0; it < ITERS; it++)
+	{
+	  int i = omp_barrier_reduce_int (me + it, omp_reduction_sum);
+	  long l = omp_barrier_reduce_long (-(long) me - it,
+					    omp_reduction_min);
+	  float f = omp_barrier_reduce_float ((float) (me * 2),
+					      omp_reduction_max);
+	  double d = omp_barrier_reduce_double (me + 0.5,
+						omp_reduction_sum);
+
+	  if (i != n * (n - 1) / 2 + n * it)
+	    err |= 1;
+	  if (l != -(long) (n - 1) - it)
+	    err |= 2;
+	  if (f != (float) ((n - 1) * 2))
+	    err |= 4;
+	  if (d != n * (n - 1) / 2 + n * 0.5)
+	    err |= 8;
+	  if (omp_barrier_reduce_int (me, omp_reduction_min) != 0)
+	    err |= 16;
+	  if (omp_barrier_reduce_double (-me, omp_reduction_max) != 0.0)
+	    err |= 32;
+	}
+    }
+
+  if (err)
+    abort ();
+  return 0;
+}
@@ -0,0 +1,47 @@
+/* { dg-do run } */
+
+#include <omp.h>
+#include <stdlib.h>
+
+#define ITERS 500
+
+int a[64];
+
+int
+main (void)
+{
+  int nt, err = 0;
+
+  /* Orphaned split-phase barriers are no-ops.  */
+  omp_barrier_wait (omp_barrier_arrive ());
+
+  for (nt = 1; nt <= 8; nt++)
+    #pragma omp parallel num_threads (nt) reduction (|:err)
+    {
+      int n = omp_get_num_threads ();
+      int me = omp_get_thread_num ();
+      int it, j;
+
+      for (it = 0; it < ITERS; it++)
+	{
+	  omp_barrier_token_t token;
+	  volatile int local = 0;
+
+	  __atomic_store_n (&a[me], it, __ATOMIC_RELAXED);
+	  token = omp_barrier_arrive ();
+	  /* Work that doesn't depend on the other threads.  */
+	  for (j = 0; j < me * 10; j++)
+	    local += j;
+	  omp_barrier_wait (token);
+	  for (j = 0; j < n; j++)
+	    if (__atomic_load_n (&a[j], __ATOMIC_RELAXED) != it)
+	      err = 1;
+	  /* Nobody may store the next value before everybody checked.  */
+	  #pragma omp barrier
+	}
+    }
+
+  if (err)
+    abort ();
+  return 0;
+}
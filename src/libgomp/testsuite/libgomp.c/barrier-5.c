@@ -0,0 +1,4 @@
+/* { dg-do run } */
+/* { dg-set-target-env-var GOMP_BARRIER "TREE" } */
+
+#include "barrier-3.c"
@@ -0,0 +1,70 @@
+/* { dg-do run } */
+
+/* Threads running ahead through a long chain of nowait constructs must
+   get past more constructs than the team keeps work shares for, and
+   every iteration must still run exactly once.  */
+
+#include <omp.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define N 64
+#define M 40
+
+int cnt[M][N];
+int singles[M];
+
+int
+main ()
+{
+  int r, j, k;
+
+  for (r = 0; r < 3; r++)
+    {
+      #pragma omp parallel private (j, k)
+      {
+	if (omp_get_thread_num () == 0)
+	  usleep (20000);
+	for (j = 0; j < M; j++)
+	  {
+	    if (j % 3 == 0)
+	      {
+		#pragma omp for schedule (dynamic, 3) nowait
+		for (k = 0; k < N; k++)
+		  {
+		    #pragma omp atomic
+		    cnt[j][k]++;
+		  }
+	      }
+	    else if (j % 3 == 1)
+	      {
+		#pragma omp for schedule (guided) nowait
+		for (k = 0; k < N; k++)
+		  {
+		    #pragma omp atomic
+		    cnt[j][k]++;
+		  }
+	      }
+	    else
+	      {
+		#pragma omp single nowait
+		{
+		  #pragma omp atomic
+		  singles[j]++;
+		}
+	      }
+	  }
+      }
+      for (j = 0; j < M; j++)
+	if (j % 3 == 2)
+	  {
+	    if (singles[j] != r + 1)
+	      abort ();
+	  }
+	else
+	  for (k = 0; k < N; k++)
+	    if (cnt[j][k] != r + 1)
+	      abort ();
+    }
+  return 0;
+}
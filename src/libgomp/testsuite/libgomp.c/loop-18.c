@@ -0,0 +1,103 @@
+/* { dg-do run } */
+/* { dg-set-target-env-var GOMP_ITER_POOLS "4" } */
+
+/* With the iteration space of dynamic and guided loops split into pools,
+   every iteration must still run exactly once.  */
+
+#include <omp.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define N 1000
+
+int cnt[N];
+
+static void
+check (void)
+{
+  int i;
+
+  for (i = 0; i < N; i++)
+    if (cnt[i] != 1)
+      abort ();
+  memset (cnt, 0, sizeof (cnt));
+}
+
+int
+main ()
+{
+  int i, c, nt;
+
+  for (nt = 1; nt <= 8; nt++)
+    for (c = 1; c <= 64; c *= 4)
+      {
+	#pragma omp parallel num_threads (nt) private (i)
+	{
+	  #pragma omp for schedule (dynamic, c)
+	  for (i = 0; i < N; i++)
+	    {
+	      #pragma omp atomic
+	      cnt[i]++;
+	    }
+	  #pragma omp single
+	  check ();
+	  #pragma omp for schedule (dynamic, c) nowait
+	  for (i = N - 1; i >= 0; i -= 3)
+	    {
+	      #pragma omp atomic
+	      cnt[i]++;
+	    }
+	  #pragma omp for schedule (dynamic, c)
+	  for (i = N - 2; i >= 0; i -= 3)
+	    {
+	      #pragma omp atomic
+	      cnt[i]++;
+	    }
+	  #pragma omp for schedule (dynamic, c)
+	  for (i = N - 3; i >= 0; i -= 3)
+	    {
+	      #pragma omp atomic
+	      cnt[i]++;
+	    }
+	  #pragma omp single
+	  check ();
+	  #pragma omp for schedule (guided, c)
+	  for (i = 0; i < N; i++)
+	    {
+	      #pragma omp atomic
+	      cnt[i]++;
+	    }
+	  #pragma omp single
+	  check ();
+	  #pragma omp for schedule (guided, c) nowait
+	  for (i = N - 1; i >= 0; i -= 2)
+	    {
+	      #pragma omp atomic
+	      cnt[i]++;
+	    }
+	  #pragma omp for schedule (guided, c)
+	  for (i = N - 2; i >= 0; i -= 2)
+	    {
+	      #pragma omp atomic
+	      cnt[i]++;
+	    }
+	  #pragma omp single
+	  check ();
+	}
+	#pragma omp parallel for schedule (dynamic, c) num_threads (nt)
+	for (i = 0; i < N; i++)
+	  {
+	    #pragma omp atomic
+	    cnt[i]++;
+	  }
+	check ();
+	#pragma omp parallel for schedule (guided, c) num_threads (nt)
+	for (i = 0; i < N; i++)
+	  {
+	    #pragma omp atomic
+	    cnt[i]++;
+	  }
+	check ();
+      }
+  return 0;
+}
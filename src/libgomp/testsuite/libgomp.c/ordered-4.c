@@ -0,0 +1,4 @@
+/* { dg-do run } */
+/* { dg-set-target-env-var GOMP_ORDERED_TICKETS "true" } */
+
+#include "ordered-3.c"
@@ -0,0 +1,58 @@
+/* { dg-do run } */
+/* { dg-set-target-env-var OMP_MAX_TASK_PRIORITY "9" } */
+
+#include <omp.h>
+#include <stdlib.h>
+
+#define N 90
+
+int order[N], pos;
+volatile int go;
+
+int
+main (void)
+{
+  int i;
+
+  if (omp_get_max_task_priority () != 9)
+    abort ();
+
+  /* Thread 0 queues tasks of priorities 1 to 9 while thread 1 is kept
+     busy, then both run them highest priority first.  */
+  #pragma omp parallel num_threads (2)
+  {
+    if (omp_get_thread_num () == 0)
+      {
+	for (i = 0; i < N; i++)
+	  #pragma omp task priority (i % 9 + 1) firstprivate (i)
+	  {
+	    int p;
+
+	    #pragma omp atomic capture
+	    p = pos++;
+	    order[p] = i % 9 + 1;
+	  }
+	go = 1;
+      }
+    else
+      while (!go)
+	;
+  }
+
+  if (pos != N)
+    abort ();
+  for (i = 0; i < 5; i++)
+    if (order[i] != 9)
+      abort ();
+  for (i = N - 5; i < N; i++)
+    if (order[i] > 2)
+      abort ();
+
+  /* Priorities above the maximum are clamped to it.  */
+  #pragma omp parallel
+  #pragma omp single
+  for (i = 0; i < 64; i++)
+    #pragma omp task priority (100 + i)
+      ;
+  return 0;
+}
@@ -0,0 +1,42 @@
+/* { dg-do run } */
+
+/* A tied task waiting in taskwait may only run its own descendants
+   meanwhile, or it could run a sibling which needs the lock it holds.  */
+
+#include <omp.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+omp_lock_t lock;
+int cnt, children;
+
+int
+main ()
+{
+  int i;
+
+  omp_init_lock (&lock);
+  #pragma omp parallel num_threads (4)
+  #pragma omp single
+  for (i = 0; i < 200; i++)
+    #pragma omp task
+    {
+      int j;
+
+      omp_set_lock (&lock);
+      cnt++;
+      for (j = 0; j < 4; j++)
+	#pragma omp task
+	{
+	  usleep (10);
+	  #pragma omp atomic
+	  children++;
+	}
+      #pragma omp taskwait
+      omp_unset_lock (&lock);
+    }
+  omp_destroy_lock (&lock);
+  if (cnt != 200 || children != 800)
+    abort ();
+  return 0;
+}
@@ -0,0 +1,36 @@
+/* { dg-do run } */
+
+/* A thread waiting in taskwait must get past a grandchild at the bottom
+   of its deque to the child queued before it.  */
+
+#include <omp.h>
+#include <stdlib.h>
+
+int x;
+
+int
+main ()
+{
+  int i;
+
+  for (i = 1; i <= 4; i++)
+    {
+      x = 0;
+      #pragma omp parallel num_threads (i)
+      {
+	#pragma omp task
+	#pragma omp atomic
+	x++;
+	#pragma omp task
+	{
+	  #pragma omp task
+	  #pragma omp atomic
+	  x++;
+	}
+	#pragma omp taskwait
+      }
+      if (x != 2 * i)
+	abort ();
+    }
+  return 0;
+}
@@ -0,0 +1,76 @@
+/* { dg-do run } */
+
+#include <omp.h>
+#include <stdlib.h>
+
+#define N 32
+#define STEPS 40
+
+long a[N], ref[N];
+
+static void
+step (int s, int graph, int extra)
+{
+  int i;
+
+  if (graph)
+    omp_taskgraph_begin (3);
+  for (i = 0; i < N; i++)
+    {
+      int l = (i + N - 1) % N;
+      #pragma omp task depend(inout: a[i]) depend(in: a[l]) firstprivate(i, l, s)
+	a[i] = a[i] * 3 + a[l] + s;
+      if (i % 8 == 0)
+	#pragma omp task depend(in: a[i]) firstprivate(i)
+	  {
+	    volatile long x = a[i];
+	    (void) x;
+	  }
+    }
+  /* A task that isn't in the graph makes it drop the graph.  */
+  if (extra)
+    #pragma omp task depend(inout: a[0])
+      a[0] += 1;
+  if (graph)
+    omp_taskgraph_end ();
+}
+
+static void
+run (int graph)
+{
+  int s;
+
+  for (s = 0; s < N; s++)
+    a[s] = s;
+  #pragma omp parallel
+  #pragma omp single
+  for (s = 0; s < STEPS; s++)
+    step (s, graph, s == 17);
+}
+
+int
+main ()
+{
+  int i, k;
+
+  run (0);
+  for (i = 0; i < N; i++)
+    ref[i] = a[i];
+  for (k = 0; k < 3; k++)
+    {
+      run (1);
+      for (i = 0; i < N; i++)
+	if (a[i] != ref[i])
+	  abort ();
+      if (k == 1)
+	omp_taskgraph_reset (3);
+    }
+  /* Without a team, all tasks run right away.  */
+  omp_taskgraph_begin (4);
+  #pragma omp task
+    a[0] = -1;
+  if (a[0] != -1)
+    abort ();
+  omp_taskgraph_end ();
+  return 0;
+}
@@ -0,0 +1,55 @@
+/* { dg-do run } */
+
+/* Tasks that may not be deferred still run right away when a task
+   graph is replayed.  */
+
+#include <omp.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+int
+main ()
+{
+  int step;
+
+  for (step = 0; step < 5; step++)
+    {
+      int x = 0, y = 0, z = 0;
+
+      #pragma omp parallel num_threads (2) shared (x, y, z)
+      #pragma omp single
+      {
+	omp_taskgraph_begin (5);
+	#pragma omp task depend(out: y) shared (y)
+	  {
+	    usleep (1000);
+	    y = 1;
+	  }
+	#pragma omp task if (0) shared (x)
+	  {
+	    usleep (2000);
+	    x = step + 1;
+	  }
+	if (x != step + 1)
+	  abort ();
+	omp_taskgraph_end ();
+	if (y != 1)
+	  abort ();
+
+	/* Tasks created in a final task are included.  */
+	#pragma omp task final (1) shared (z)
+	  {
+	    omp_taskgraph_begin (6);
+	    #pragma omp task shared (z)
+	      {
+		usleep (2000);
+		z = step + 1;
+	      }
+	    if (z != step + 1)
+	      abort ();
+	    omp_taskgraph_end ();
+	  }
+      }
+    }
+  return 0;
+}
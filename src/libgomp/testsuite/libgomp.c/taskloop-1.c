@@ -0,0 +1,97 @@
+/* { dg-do run } */
+
+#include <omp.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define N 1000
+
+int a[N], cnt[N];
+unsigned work[N];
+
+static void
+check (int lo, int hi, int val)
+{
+  int i;
+
+  for (i = 0; i < N; i++)
+    if (a[i] != ((i >= lo && i < hi) ? val : 0))
+      abort ();
+  memset (a, 0, sizeof (a));
+}
+
+int
+main (void)
+{
+  unsigned long long u;
+  long l;
+  int i;
+
+  #pragma omp parallel
+  #pragma omp single
+  {
+    #pragma omp taskloop
+    for (i = 0; i < N; i++)
+      a[i] += 1;
+    check (0, N, 1);
+
+    #pragma omp taskloop grainsize (7)
+    for (l = N - 1; l >= 3; l -= 2)
+      a[l] += 2;
+    for (i = 3; i < N; i++)
+      if (a[i] != ((i & 1) ? 2 : 0))
+	abort ();
+    memset (a, 0, sizeof (a));
+
+    #pragma omp taskloop num_tasks (13) priority (1)
+    for (i = 17; i < N - 5; i++)
+      a[i] += 3;
+    check (17, N - 5, 3);
+
+    #pragma omp taskloop num_tasks (5) if (0)
+    for (i = 0; i < N; i++)
+      a[i] += 4;
+    check (0, N, 4);
+
+    #pragma omp taskloop grainsize (50) final (1) untied
+    for (i = 0; i < N; i++)
+      a[i] += 5;
+    check (0, N, 5);
+
+    #pragma omp taskloop nogroup
+    for (i = 0; i < N; i++)
+      a[i] += 6;
+    #pragma omp taskwait
+    check (0, N, 6);
+
+    /* An unsigned long long loop goes through GOMP_taskloop_ull.  */
+    #pragma omp taskloop grainsize (31)
+    for (u = 10ULL; u < N; u += 3)
+      a[u] += 7;
+    for (i = 0; i < N; i++)
+      if (a[i] != ((i >= 10 && (i - 10) % 3 == 0) ? 7 : 0))
+	abort ();
+    memset (a, 0, sizeof (a));
+
+    #pragma omp taskloop num_tasks (4)
+    for (u = N; u > 0; u--)
+      a[u - 1] += 8;
+    check (0, N, 8);
+  }
+
+  /* With a workload the tasks get unequal iteration counts, but every
+     iteration still runs exactly once.  */
+  for (i = 0; i < N; i++)
+    work[i] = (i % 97 == 0) ? 1000 : 1 + i % 5;
+  omp_set_workload (0, work, N, true);
+  #pragma omp parallel
+  #pragma omp single
+  #pragma omp taskloop num_tasks (8)
+  for (i = 0; i < N; i++)
+    __atomic_add_fetch (&cnt[i], 1, __ATOMIC_RELAXED);
+  for (i = 0; i < N; i++)
+    if (cnt[i] != 1)
+      abort ();
+  return 0;
+}
@@ -26,67 +26,74 @@
    of threads.  */
 
 #include "libgomp.h"
+#include "ticket.h"
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
 
-/* Allocate a new work share structure, preferably from current team's
-   free gomp_work_share cache.  */
+/* The work sharing constructs of a team use the slots of its work share
+   ring in turn: construct N, counting from 1, uses slot N - 1 modulo the
+   size of the ring.  The first thread to reach a construct claims its
+   slot, once all threads are done with the construct that used it
+   before, and initializes it; the others wait until it has.  The last
+   thread done with the construct releases the slot.  Entering a
+   construct thus takes neither a lock nor the allocator.  A thread that
+   gets so far ahead through nowait constructs that its slot is still in
+   use waits for it, and has later teams get a larger ring.  */
 
-static struct gomp_work_share *
-alloc_work_share (struct gomp_team *team)
+/* Set up the work share ring of TEAM for its first constructs.  */
+
+void
+gomp_work_share_ring_reset (struct gomp_team *team)
 {
-  struct gomp_work_share *ws;
-  unsigned int i;
+  unsigned i;
 
-  /* This is called in a critical section.  */
-  if (team->work_share_list_alloc != NULL)
+  for (i = 0; i < team->work_share_chunk; i++)
     {
-      ws = team->work_share_list_alloc;
-      team->work_share_list_alloc = ws->next_free;
-      return ws;
+      struct gomp_work_share *ws = &team->work_share_ring[i];
+
+      ws->ring_serving = 2 * (i + 1);
+      ws->ring_sleepers = 0;
+      ws->ring_arrived = 0;
     }
+  team->work_share_want = team->work_share_chunk;
+}
 
-#ifdef HAVE_SYNC_BUILTINS
-  ws = team->work_share_list_free;
-  /* We need atomic read from work_share_list_free,
-     as free_work_share can be called concurrently.  */
-  __asm ("" : "+r" (ws));
+/* Return the slot of the work share ring of TEAM for construct SEQ.  */
 
-  if (ws && ws->next_free)
-    {
-      struct gomp_work_share *next = ws->next_free;
-      ws->next_free = NULL;
-      team->work_share_list_alloc = next->next_free;
-      return next;
-    }
-#else
-  gomp_mutex_lock (&team->work_share_list_free_lock);
-  ws = team->work_share_list_free;
-  if (ws)
-    {
-      team->work_share_list_alloc = ws->next_free;
-      team->work_share_list_free = NULL;
-      gomp_mutex_unlock (&team->work_share_list_free_lock);
-      return ws;
-    }
-  gomp_mutex_unlock (&team->work_share_list_free_lock);
-#endif
+static inline struct gomp_work_share *
+gomp_work_share_slot (struct gomp_team *team, unsigned seq)
+{
+  return &team->work_share_ring[(seq - 1) & (team->work_share_chunk - 1)];
+}
+
+/* Set up the N freshly allocated work shares at WS as having no
+   iteration pools yet.  */
+
+void
+gomp_init_work_share_pools (struct gomp_work_share *ws, unsigned n)
+{
+  unsigned i;
 
-  team->work_share_chunk *= 2;
-  ws = gomp_malloc (team->work_share_chunk * sizeof (struct gomp_work_share));
-  ws->next_alloc = team->work_shares[0].next_alloc;
-  team->work_shares[0].next_alloc = ws;
-  team->work_share_list_alloc = &ws[1];
-  for (i = 1; i < team->work_share_chunk - 1; i++)
-    ws[i].next_free = &ws[i + 1];
-  ws[i].next_free = NULL;
-  return ws;
+  for (i = 0; i < n; i++)
+    ws[i].pools = NULL;
+}
+
+/* Free the iteration pools of the N work shares at WS, before the work
+   shares themselves are freed.  */
+
+void
+gomp_free_work_share_pools (struct gomp_work_share *ws, unsigned n)
+{
+  unsigned i;
+
+  for (i = 0; i < n; i++)
+    gomp_aligned_free (ws[i].pools);
 }
 
 /* Initialize an already allocated struct gomp_work_share.
-   This shouldn't touch the next_alloc field.  */
+   This shouldn't touch the ring_* fields or POOLS.  */
 
 void
 gomp_init_work_share (struct gomp_work_share *ws, bool ordered,
@@ -110,17 +117,20 @@ gomp_init_work_share (struct gomp_work_share *ws, bool ordered,
       ws->ordered_num_used = 0;
       ws->ordered_owner = -1;
       ws->ordered_cur = 0;
+      ws->ordered_next_ticket = 0;
+      ws->ordered_serving = 0;
+      ws->ordered_sleepers = 0;
     }
   else
     ws->ordered_team_ids = NULL;
-  gomp_ptrlock_init (&ws->next_ws, NULL);
   ws->threads_completed = 0;
-  ws->thread_start = NULL;
   ws->taskmap = NULL;
+  ws->taskmap_free = NULL;
+  ws->npools = 1;
 }
 
-/* Do any needed destruction of gomp_work_share fields before it
-   is put back into free gomp_work_share cache or freed.  */
+/* Do any needed destruction of gomp_work_share fields before its
+   slot is released or it is freed.  */
 
 void
 gomp_fini_work_share (struct gomp_work_share *ws)
@@ -128,39 +138,30 @@ gomp_fini_work_share (struct gomp_work_share *ws)
   gomp_mutex_destroy (&ws->lock);
   if (ws->ordered_team_ids != ws->inline_ordered_team_ids)
     free (ws->ordered_team_ids);
-  if (ws->thread_start != NULL)
-	free(ws->thread_start);
-  gomp_ptrlock_destroy (&ws->next_ws);
+  free (ws->taskmap_free);
 }
 
-/* Free a work share struct, if not orphaned, put it into current
-   team's free gomp_work_share cache.  */
+/* Free an orphaned work share.  */
 
 static inline void
-free_work_share (struct gomp_team *team, struct gomp_work_share *ws)
+free_work_share (struct gomp_work_share *ws)
 {
   gomp_fini_work_share (ws);
-  if (__builtin_expect (team == NULL, 0))
-    free (ws);
-  else
-    {
-      struct gomp_work_share *next_ws;
-#ifdef HAVE_SYNC_BUILTINS
-      do
-	{
-	  next_ws = team->work_share_list_free;
-	  ws->next_free = next_ws;
-	}
-      while (!__sync_bool_compare_and_swap (&team->work_share_list_free,
-					    next_ws, ws));
-#else
-      gomp_mutex_lock (&team->work_share_list_free_lock);
-      next_ws = team->work_share_list_free;
-      ws->next_free = next_ws;
-      team->work_share_list_free = ws;
-      gomp_mutex_unlock (&team->work_share_list_free_lock);
-#endif
-    }
+  gomp_free_work_share_pools (ws, 1);
+  gomp_aligned_free (ws);
+}
+
+/* Release WS, the slot of construct SEQ of TEAM, for the construct the
+   size of the ring after it.  All threads must be done with WS.  */
+
+static inline void
+gomp_work_share_release (struct gomp_team *team, struct gomp_work_share *ws,
+			 unsigned seq)
+{
+  gomp_fini_work_share (ws);
+  __atomic_store_n (&ws->ring_arrived, 0, MEMMODEL_RELAXED);
+  gomp_ticket_serve (&ws->ring_serving, &ws->ring_sleepers,
+		     2 * (seq + team->work_share_chunk));
 }
 
 /* The current thread is ready to begin the next work sharing construct.
@@ -174,32 +175,56 @@ gomp_work_share_start (bool ordered)
   struct gomp_thread *thr = gomp_thread ();
   struct gomp_team *team = thr->ts.team;
   struct gomp_work_share *ws;
+  unsigned seq, cur;
 
   /* Work sharing constructs can be orphaned.  */
   if (team == NULL)
     {
-      ws = gomp_malloc (sizeof (*ws));
+      ws = gomp_aligned_alloc (64, sizeof (*ws));
+      gomp_init_work_share_pools (ws, 1);
       gomp_init_work_share (ws, ordered, 1);
       thr->ts.work_share = ws;
       return ws;
     }
 
-  ws = thr->ts.work_share;
-  thr->ts.last_work_share = ws;
-  ws = gomp_ptrlock_get (&ws->next_ws);
-  if (ws == NULL)
+  seq = ++thr->ts.work_share_seq;
+  ws = gomp_work_share_slot (team, seq);
+  thr->ts.work_share = ws;
+  cur = __atomic_load_n (&ws->ring_serving, MEMMODEL_ACQUIRE);
+  if ((int) (cur - 2 * seq) > 0)
+    return false;
+  if (__builtin_expect ((int) (cur - 2 * seq) < 0, 0))
+    {
+      /* Some thread is still in the construct that used the slot
+	 before.  */
+      if (team->work_share_chunk < GOMP_WORK_SHARE_RING_MAX)
+	__atomic_store_n (&team->work_share_want, 2 * team->work_share_chunk,
+			  MEMMODEL_RELAXED);
+      gomp_ticket_wait (&ws->ring_serving, &ws->ring_sleepers, 2 * seq);
+    }
+  if (__atomic_fetch_add (&ws->ring_arrived, 1, MEMMODEL_ACQ_REL) == 0)
     {
       /* This thread encountered a new ws first.  */
-      struct gomp_work_share *ws = alloc_work_share (team);
       gomp_init_work_share (ws, ordered, team->nthreads);
-      thr->ts.work_share = ws;
       return true;
     }
-  else
-    {
-      thr->ts.work_share = ws;
-      return false;
-    }
+  gomp_ticket_wait (&ws->ring_serving, &ws->ring_sleepers, 2 * seq + 1);
+  return false;
+}
+
+/* Called by the first thread to reach a work sharing construct once it
+   has initialized the work share, to let the other threads in.  */
+
+void
+gomp_work_share_init_done (void)
+{
+  struct gomp_thread *thr = gomp_thread ();
+
+  /* Work sharing constructs can be orphaned.  */
+  if (__builtin_expect (thr->ts.team != NULL, 1))
+    gomp_ticket_serve (&thr->ts.work_share->ring_serving,
+		       &thr->ts.work_share->ring_sleepers,
+		       2 * thr->ts.work_share_seq + 1);
 }
 
 /* The current thread is done with its current work sharing construct.
@@ -215,24 +240,19 @@ gomp_work_share_end (void)
   /* Work sharing constructs can be orphaned.  */
   if (team == NULL)
     {
-      free_work_share (NULL, thr->ts.work_share);
+      free_work_share (thr->ts.work_share);
       thr->ts.work_share = NULL;
       return;
     }
 
-  bstate = gomp_barrier_wait_start (&team->barrier);
+  bstate = gomp_team_barrier_wait_start (&team->barrier);
 
-  if (gomp_barrier_last_thread (bstate))
-    {
-      if (__builtin_expect (thr->ts.last_work_share != NULL, 1))
-	{
-	  team->work_shares_to_free = thr->ts.work_share;
-	  free_work_share (team, thr->ts.last_work_share);
-	}
-    }
+  if (gomp_barrier_last_thread (bstate)
+      && __builtin_expect (thr->ts.work_share_seq != 0, 1))
+    gomp_work_share_release (team, thr->ts.work_share,
+			     thr->ts.work_share_seq);
 
   gomp_team_barrier_wait_end (&team->barrier, bstate);
-  thr->ts.last_work_share = NULL;
 }
 
 /* The current thread is done with its current work sharing construct.
@@ -246,17 +266,12 @@ gomp_work_share_end_cancel (void)
   gomp_barrier_state_t bstate;
 
   /* Cancellable work sharing constructs cannot be orphaned.  */
-  bstate = gomp_barrier_wait_cancel_start (&team->barrier);
+  bstate = gomp_team_barrier_wait_cancel_start (&team->barrier);
 
-  if (gomp_barrier_last_thread (bstate))
-    {
-      if (__builtin_expect (thr->ts.last_work_share != NULL, 1))
-	{
-	  team->work_shares_to_free = thr->ts.work_share;
-	  free_work_share (team, thr->ts.last_work_share);
-	}
-    }
-  thr->ts.last_work_share = NULL;
+  if (gomp_barrier_last_thread (bstate)
+      && __builtin_expect (thr->ts.work_share_seq != 0, 1))
+    gomp_work_share_release (team, thr->ts.work_share,
+			     thr->ts.work_share_seq);
 
   return gomp_team_barrier_wait_cancel_end (&team->barrier, bstate);
 }
@@ -275,12 +290,13 @@ gomp_work_share_end_nowait (void)
   /* Work sharing constructs can be orphaned.  */
   if (team == NULL)
     {
-      free_work_share (NULL, ws);
+      free_work_share (ws);
       thr->ts.work_share = NULL;
       return;
     }
 
-  if (__builtin_expect (thr->ts.last_work_share == NULL, 0))
+  /* The initial work share of the team isn't in the ring.  */
+  if (__builtin_expect (thr->ts.work_share_seq == 0, 0))
     return;
 
 #ifdef HAVE_SYNC_BUILTINS
@@ -292,9 +308,5 @@ gomp_work_share_end_nowait (void)
 #endif
 
   if (completed == team->nthreads)
-    {
-      team->work_shares_to_free = thr->ts.work_share;
-      free_work_share (team, thr->ts.last_work_share);
-    }
-  thr->ts.last_work_share = NULL;
+    gomp_work_share_release (team, ws, thr->ts.work_share_seq);
 }